@@ -1,9 +1,21 @@
 #define _GNU_SOURCE
 #include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
+#include "cm2_trace.h"
 
 char tmpbuff[1024];
 unsigned long tmppos = 0;
@@ -24,6 +36,528 @@ static void * (*myfn_memalign)(size_t blocksize, size_t bytes);
 static void * (*myfn_mmap)(void *ptr,  size_t length, int prot, int flags, int fd, off_t offset);
 static int (*myfn_munmap)(void *ptr, size_t length);
 
+/*=========================================================
+ * binary tracing
+ *
+ * Every hook appends a fixed-size cm2_record to a ring owned by the calling
+ * thread; nothing is formatted and no syscall is made on the hot path. A
+ * flusher thread drains all rings to the trace file every CM2_FLUSH_MS, a
+ * thread whose ring fills up drains it itself, and everything left is written
+ * at exit. The file is named by $CM2_TRACE (default cm2_trace.<pid>.bin);
+ * decode it with cm2_decode.
+ */
+
+#define CM2_RING_RECORDS 8192 // Records per thread ring, a power of two
+#define CM2_FLUSH_MS 50       // Interval of the flusher thread
+
+typedef struct trace_ring {
+  cm2_record records[CM2_RING_RECORDS];
+  uint64_t head;              // Next record to write, advanced by the owning thread only
+  uint64_t tail;              // Next record to flush, advanced under flush_lock only
+  pthread_mutex_t flush_lock; // Serializes the flusher and an owner draining its full ring
+  int in_use;                 // Cleared when the owning thread exits so the ring can be reused
+  struct trace_ring *next;    // All rings ever created, for the flusher
+} trace_ring;
+
+static trace_ring *rings;              // Registry of rings, only ever pushed to
+static int trace_fd = -1;
+static int trace_final;                // Set after the exit flush, later records are written directly
+static int flusher_started;
+static pthread_key_t ring_key;         // Its destructor releases a thread's ring
+static __thread trace_ring *my_ring __attribute__((tls_model("initial-exec")));
+static __thread uint32_t my_tid __attribute__((tls_model("initial-exec")));
+
+static void trace_open(int forked){
+  char path[256];
+  const char *env = getenv("CM2_TRACE");
+  if (env && forked)
+    snprintf(path, sizeof(path), "%s.%d", env, (int)getpid()); // Keep the parent's trace intact
+  else if (env)
+    snprintf(path, sizeof(path), "%s", env);
+  else
+    snprintf(path, sizeof(path), "cm2_trace.%d.bin", (int)getpid());
+
+  trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (trace_fd < 0)
+    return;
+  cm2_trace_header header = {CM2_TRACE_MAGIC, CM2_TRACE_VERSION, sizeof(cm2_record), (uint64_t)getpid()};
+  if (write(trace_fd, &header, sizeof(header)) != sizeof(header)) {
+    close(trace_fd);
+    trace_fd = -1;
+  }
+}
+
+// Writes out everything between tail and head, called with flush_lock held
+static void ring_drain(trace_ring *ring){
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = ring->tail;
+  while (tail != head) {
+    // At most two writes per drain: up to the end of the array, then from its start
+    uint64_t first = tail % CM2_RING_RECORDS;
+    uint64_t count = head - tail;
+    if (first + count > CM2_RING_RECORDS)
+      count = CM2_RING_RECORDS - first;
+    if (trace_fd >= 0 && write(trace_fd, &ring->records[first], count * sizeof(cm2_record)) < 0)
+      break;
+    tail += count;
+  }
+  __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE); // Records that failed to write are dropped
+}
+
+static void flush_all(){
+  for (trace_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+    pthread_mutex_lock(&ring->flush_lock);
+    ring_drain(ring);
+    pthread_mutex_unlock(&ring->flush_lock);
+  }
+}
+
+static void profile_dump(int numbered);
+static int dump_requested;             // Set by the SIGUSR2 handler, served by the flusher
+
+static void *flusher(void *arg){
+  struct timespec interval = {0, CM2_FLUSH_MS * 1000000L};
+  while (1) {
+    nanosleep(&interval, NULL);
+    if (trace_fd >= 0)
+      flush_all();
+    if (__atomic_exchange_n(&dump_requested, 0, __ATOMIC_ACQ_REL))
+      profile_dump(1);
+  }
+  return NULL;
+}
+
+static void start_flusher(){
+  if (!__atomic_load_n(&flusher_started, __ATOMIC_RELAXED) && !__atomic_exchange_n(&flusher_started, 1, __ATOMIC_ACQ_REL)) {
+    // pthread_create allocates, its calls land here again and find flusher_started set
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, flusher, NULL) == 0)
+      pthread_detach(thread);
+  }
+}
+
+static void ring_release(void *ring){
+  __atomic_store_n(&((trace_ring *)ring)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+// Finds a ring for the calling thread: one left behind by an exited thread, or a new one
+static trace_ring *ring_acquire(){
+  for (trace_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&ring->in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return ring;
+  }
+
+  // Straight from the kernel, so the ring never shows up in the trace itself
+  trace_ring *ring = myfn_mmap(NULL, sizeof(trace_ring), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED)
+    return NULL;
+  pthread_mutex_init(&ring->flush_lock, NULL);
+  ring->in_use = 1;
+  ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+  return ring;
+}
+
+// CLOCK_MONOTONIC nanoseconds, the timestamp of a record
+static uint64_t trace_clock(){
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Appends a record stamped with @p timestamp to the calling thread's ring
+static void trace_at(uint64_t timestamp, uint16_t op, uint64_t size, const void *ptr, const void *result){
+  if (trace_fd < 0)
+    return;
+  trace_ring *ring = my_ring;
+  if (!ring) {
+    ring = my_ring = ring_acquire();
+    if (!ring)
+      return;
+    my_tid = (uint32_t)syscall(SYS_gettid);
+    pthread_setspecific(ring_key, ring);
+  }
+
+  if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == CM2_RING_RECORDS) {
+    // Ring full and the flusher has not caught up: drain it on this thread
+    pthread_mutex_lock(&ring->flush_lock);
+    ring_drain(ring);
+    pthread_mutex_unlock(&ring->flush_lock);
+  }
+  cm2_record *record = &ring->records[ring->head % CM2_RING_RECORDS];
+  record->timestamp = timestamp;
+  record->size = size;
+  record->ptr = (uint64_t)(uintptr_t)ptr;
+  record->result = (uint64_t)(uintptr_t)result;
+  record->tid = my_tid;
+  record->op = op;
+  record->reserved = 0;
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+
+  if (__atomic_load_n(&trace_final, __ATOMIC_RELAXED)) {
+    pthread_mutex_lock(&ring->flush_lock);
+    ring_drain(ring);
+    pthread_mutex_unlock(&ring->flush_lock);
+  }
+  else
+    start_flusher();
+}
+
+// Appends a record stamped now
+static void trace(uint16_t op, uint64_t size, const void *ptr, const void *result){
+  if (trace_fd >= 0)
+    trace_at(trace_clock(), op, size, ptr, result);
+}
+
+/*=========================================================
+ * sampling heap profiler
+ *
+ * With $CM2_SAMPLE=N (bytes, K/M/G suffixes allowed) no trace is written;
+ * instead about one allocation per N bytes is sampled together with its call
+ * stack. Sampling is geometric: each thread counts down an exponentially
+ * distributed number of bytes, so every allocated byte has the same 1/N
+ * chance of being picked and the hot path is one thread-local subtraction.
+ * Sampled blocks stay in a live table until freed, their weights aggregated
+ * per call stack. The profile is written in the legacy gperftools heap format
+ * (readable by pprof) to $CM2_PROFILE.heap, default cm2_heap.<pid>.heap, at
+ * exit and to a numbered file on every SIGUSR2.
+ */
+
+#define CM2_MAX_FRAMES 32
+#define CM2_SKIP_FRAMES 2     // sample_alloc and the hook; backtrace() leaves out its own frame
+#define CM2_STACK_SLOTS 4096  // Distinct call stacks, a power of two
+#define CM2_LIVE_SLOTS 65536  // Sampled blocks not yet freed, a power of two
+
+typedef struct sample_stack {
+  uint64_t hash;                   // 0 marks an unused slot
+  int depth;
+  void *frames[CM2_MAX_FRAMES];
+  double live_count, live_bytes;   // Estimated blocks and bytes allocated here and not yet freed
+  double total_count, total_bytes; // Estimated blocks and bytes ever allocated here
+} sample_stack;
+
+typedef struct live_sample {
+  uintptr_t ptr;       // Sampled block, 0 marks an unused slot
+  uint32_t stack;
+  double count, bytes; // Weights added to the stack, taken back on free
+} live_sample;
+
+static uint64_t sample_rate;           // Mean bytes between samples, 0 when sampling is off
+static sample_stack *stacks;
+static live_sample *live;
+static size_t stack_count;
+static size_t live_count;              // Lets free skip the lookup while nothing is sampled
+static unsigned live_seq;              // Odd while entries move, lookups without the lock retry on change
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned dump_seq;
+static int forked_child;
+static __thread int64_t sample_countdown __attribute__((tls_model("initial-exec")));
+static __thread uint64_t sample_rng __attribute__((tls_model("initial-exec")));
+static __thread int in_sampler __attribute__((tls_model("initial-exec")));
+
+// Parses sizes such as "524288", "512K" or "1M"
+static uint64_t parse_size(const char *text){
+  char *end;
+  uint64_t value = strtoull(text, &end, 10);
+  switch (*end) {
+  case 'g': case 'G': value <<= 10; // fall through
+  case 'm': case 'M': value <<= 10; // fall through
+  case 'k': case 'K': value <<= 10;
+  }
+  return value;
+}
+
+// Exponentially distributed byte count with mean sample_rate
+static int64_t next_interval(){
+  sample_rng ^= sample_rng >> 12;
+  sample_rng ^= sample_rng << 25;
+  sample_rng ^= sample_rng >> 27;
+  double u = ((sample_rng * 0x2545f4914f6cdd1dULL >> 11) + 1) * 0x1.0p-53; // (0, 1]
+  return (int64_t)(-log(u) * sample_rate) + 1;
+}
+
+static size_t live_home(uintptr_t ptr){
+  return (ptr >> 4) * 0x9e3779b97f4a7c15ULL >> 40 & (CM2_LIVE_SLOTS - 1);
+}
+
+// Returns the slot holding @p ptr or -1, called with sample_lock held
+static long live_find(uintptr_t ptr){
+  for (size_t i = live_home(ptr); live[i].ptr; i = (i + 1) & (CM2_LIVE_SLOTS - 1))
+    if (live[i].ptr == ptr)
+      return (long)i;
+  return -1;
+}
+
+// Linear probing with backward shift deletion, so lookups never wade through
+// tombstones. Entries are copied before their old slot is reused and live_seq
+// tells lookups running without the lock that they may have missed one.
+static void live_remove(size_t hole){
+  __atomic_store_n(&live_seq, live_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (size_t j = (hole + 1) & (CM2_LIVE_SLOTS - 1); live[j].ptr; j = (j + 1) & (CM2_LIVE_SLOTS - 1)) {
+    size_t home = live_home(live[j].ptr);
+    if (((j - home) & (CM2_LIVE_SLOTS - 1)) >= ((j - hole) & (CM2_LIVE_SLOTS - 1))) {
+      live[hole].stack = live[j].stack;
+      live[hole].count = live[j].count;
+      live[hole].bytes = live[j].bytes;
+      __atomic_store_n(&live[hole].ptr, live[j].ptr, __ATOMIC_RELAXED);
+      hole = j;
+    }
+  }
+  __atomic_store_n(&live[hole].ptr, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&live_seq, live_seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&live_count, live_count - 1, __ATOMIC_RELAXED);
+}
+
+// Finds or adds the stack table entry for @p frames, called with sample_lock held
+static long stack_find(void **frames, int depth){
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < depth; i++)
+    hash = (hash ^ (uintptr_t)frames[i]) * 0x100000001b3ULL;
+  if (!hash)
+    hash = 1;
+  for (size_t i = hash & (CM2_STACK_SLOTS - 1);; i = (i + 1) & (CM2_STACK_SLOTS - 1)) {
+    sample_stack *stack = &stacks[i];
+    if (stack->hash == hash && stack->depth == depth && !memcmp(stack->frames, frames, depth * sizeof(void *)))
+      return (long)i;
+    if (!stack->hash) {
+      if (stack_count >= CM2_STACK_SLOTS * 3 / 4)
+        return -1; // Table full, the sample is dropped
+      stack->hash = hash;
+      stack->depth = depth;
+      memcpy(stack->frames, frames, depth * sizeof(void *));
+      stack_count++;
+      return (long)i;
+    }
+  }
+}
+
+// Records a sampled allocation of @p size bytes at @p ptr
+static __attribute__((noinline)) void sample_alloc(void *ptr, size_t size){
+  if (!sample_rng) {
+    // First allocation of this thread: start its countdown rather than sampling right away
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample_rng = ((uint64_t)syscall(SYS_gettid) << 32 ^ (uint64_t)now.tv_nsec) | 1;
+    sample_countdown = next_interval() - (int64_t)size;
+    if (sample_countdown >= 0)
+      return;
+  }
+  sample_countdown = next_interval();
+  if (!ptr || in_sampler)
+    return;
+
+  // The first backtrace() loads the unwinder, which allocates; in_sampler keeps that from recursing
+  in_sampler = 1;
+  void *frames[CM2_MAX_FRAMES + CM2_SKIP_FRAMES];
+  int depth = backtrace(frames, CM2_MAX_FRAMES + CM2_SKIP_FRAMES) - CM2_SKIP_FRAMES;
+  if (depth < 0)
+    depth = 0;
+
+  // Each sample stands for all the allocations like it that were not sampled
+  double probability = -expm1(-(double)size / sample_rate);
+  double count = 1 / probability, bytes = size / probability;
+
+  pthread_mutex_lock(&sample_lock);
+  long stack = stack_find(frames + CM2_SKIP_FRAMES, depth);
+  if (stack >= 0 && live_count < CM2_LIVE_SLOTS / 2) {
+    size_t i = live_home((uintptr_t)ptr);
+    while (live[i].ptr)
+      i = (i + 1) & (CM2_LIVE_SLOTS - 1);
+    live[i].stack = (uint32_t)stack;
+    live[i].count = count;
+    live[i].bytes = bytes;
+    __atomic_store_n(&live[i].ptr, (uintptr_t)ptr, __ATOMIC_RELEASE);
+    __atomic_store_n(&live_count, live_count + 1, __ATOMIC_RELAXED);
+    stacks[stack].live_count += count;
+    stacks[stack].live_bytes += bytes;
+    stacks[stack].total_count += count;
+    stacks[stack].total_bytes += bytes;
+  }
+  pthread_mutex_unlock(&sample_lock);
+  start_flusher();
+  in_sampler = 0;
+}
+
+// Counts @p size bytes towards the next sample, the only cost of an unsampled allocation.
+// Always inlined, even at -O0, so it never takes a frame of its own in a sampled stack
+static inline __attribute__((always_inline)) void sample(void *ptr, size_t size){
+  if (sample_rate && (sample_countdown -= (int64_t)size) < 0)
+    sample_alloc(ptr, size);
+}
+
+// Drops @p ptr from the live table if it was sampled; must run before the block is released
+static void sample_free(void *ptr){
+  if (!sample_rate || !ptr || !__atomic_load_n(&live_count, __ATOMIC_RELAXED))
+    return;
+  // Look without the lock first, nearly every freed block was never sampled
+  unsigned seq;
+  int found;
+  do {
+    while ((seq = __atomic_load_n(&live_seq, __ATOMIC_ACQUIRE)) & 1)
+      ;
+    found = 0;
+    for (size_t i = live_home((uintptr_t)ptr);; i = (i + 1) & (CM2_LIVE_SLOTS - 1)) {
+      uintptr_t key = __atomic_load_n(&live[i].ptr, __ATOMIC_RELAXED);
+      if (!key || key == (uintptr_t)ptr) {
+        found = key != 0;
+        break;
+      }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (!found && __atomic_load_n(&live_seq, __ATOMIC_RELAXED) != seq);
+  if (!found)
+    return;
+
+  pthread_mutex_lock(&sample_lock);
+  long i = live_find((uintptr_t)ptr);
+  if (i >= 0) {
+    sample_stack *stack = &stacks[live[i].stack];
+    stack->live_count -= live[i].count;
+    stack->live_bytes -= live[i].bytes;
+    live_remove((size_t)i);
+  }
+  pthread_mutex_unlock(&sample_lock);
+}
+
+static void sample_signal(int sig){
+  __atomic_store_n(&dump_requested, 1, __ATOMIC_RELAXED);
+}
+
+static void sample_init(){
+  stacks = myfn_mmap(NULL, CM2_STACK_SLOTS * sizeof(sample_stack), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  live = myfn_mmap(NULL, CM2_LIVE_SLOTS * sizeof(live_sample), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (stacks == MAP_FAILED || live == MAP_FAILED) {
+    fprintf(stderr, "cM2: cannot allocate the sample tables, sampling disabled\n");
+    sample_rate = 0;
+    return;
+  }
+  struct sigaction action = {0};
+  action.sa_handler = sample_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR2, &action, NULL);
+}
+
+// Formats into a stack buffer and writes it out whenever it fills up
+typedef struct profile_writer {
+  int fd;
+  size_t used;
+  char buffer[4096];
+} profile_writer;
+
+static void profile_flush(profile_writer *out){
+  size_t done = 0;
+  while (done < out->used) {
+    ssize_t n = write(out->fd, out->buffer + done, out->used - done);
+    if (n <= 0)
+      break;
+    done += (size_t)n;
+  }
+  out->used = 0;
+}
+
+static void profile_printf(profile_writer *out, const char *format, ...){
+  if (out->used > sizeof(out->buffer) - 256)
+    profile_flush(out);
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(out->buffer + out->used, sizeof(out->buffer) - out->used, format, args);
+  va_end(args);
+  if (n > 0)
+    out->used += (size_t)n < sizeof(out->buffer) - out->used ? (size_t)n : sizeof(out->buffer) - out->used - 1;
+}
+
+// Writes the aggregated profile, to a numbered file when asked for by SIGUSR2
+static void profile_dump(int numbered){
+  if (!sample_rate)
+    return;
+  char path[256];
+  const char *env = getenv("CM2_PROFILE");
+  int len;
+  if (env && forked_child)
+    len = snprintf(path, sizeof(path), "%s.%d", env, (int)getpid());
+  else if (env)
+    len = snprintf(path, sizeof(path), "%s", env);
+  else
+    len = snprintf(path, sizeof(path), "cm2_heap.%d", (int)getpid());
+  if (numbered)
+    snprintf(path + len, sizeof(path) - len, ".%04u.heap", ++dump_seq);
+  else
+    snprintf(path + len, sizeof(path) - len, ".heap");
+
+  in_sampler = 1;
+  profile_writer out;
+  out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  out.used = 0;
+  if (out.fd < 0) {
+    in_sampler = 0;
+    return;
+  }
+
+  pthread_mutex_lock(&sample_lock);
+  double live_n = 0, live_b = 0, total_n = 0, total_b = 0;
+  for (size_t i = 0; i < CM2_STACK_SLOTS; i++) {
+    live_n += stacks[i].live_count;
+    live_b += stacks[i].live_bytes;
+    total_n += stacks[i].total_count;
+    total_b += stacks[i].total_bytes;
+  }
+  profile_printf(&out, "heap profile: %.0f: %.0f [%.0f: %.0f] @ heap_v2/%llu\n",
+                 live_n, live_b, total_n, total_b, (unsigned long long)sample_rate);
+  for (size_t i = 0; i < CM2_STACK_SLOTS; i++) {
+    sample_stack *stack = &stacks[i];
+    if (!stack->hash)
+      continue;
+    profile_printf(&out, "%.0f: %.0f [%.0f: %.0f] @", stack->live_count, stack->live_bytes, stack->total_count, stack->total_bytes);
+    for (int f = 0; f < stack->depth; f++)
+      profile_printf(&out, " %p", stack->frames[f]);
+    profile_printf(&out, "\n");
+  }
+  pthread_mutex_unlock(&sample_lock);
+
+  // pprof symbolizes the addresses against the mappings of the profiled process
+  profile_printf(&out, "\nMAPPED_LIBRARIES:\n");
+  profile_flush(&out);
+  int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (maps >= 0) {
+    ssize_t n;
+    while ((n = read(maps, out.buffer, sizeof(out.buffer))) > 0) {
+      out.used = (size_t)n;
+      profile_flush(&out);
+    }
+    close(maps);
+  }
+  close(out.fd);
+  in_sampler = 0;
+}
+
+// In the child only the forking thread survives: drop the parent's records, start a new file and flusher
+static void trace_atfork_child(){
+  for (trace_ring *ring = rings; ring; ring = ring->next) {
+    pthread_mutex_init(&ring->flush_lock, NULL);
+    ring->tail = ring->head;
+    if (ring != my_ring)
+      ring->in_use = 0;
+  }
+  if (trace_fd >= 0) {
+    close(trace_fd);
+    trace_open(1);
+  }
+  flusher_started = 0;
+  // The child inherits the parent's live samples, they describe its heap too
+  pthread_mutex_init(&sample_lock, NULL);
+  live_seq &= ~1u;
+  forked_child = 1;
+}
+
+__attribute__((destructor)) static void trace_exit(){
+  __atomic_store_n(&trace_final, 1, __ATOMIC_RELAXED);
+  flush_all();
+  profile_dump(0);
+}
 
 static void init(){
   myfn_malloc     = dlsym(RTLD_NEXT, "malloc");
@@ -33,12 +567,21 @@ static void init(){
   myfn_memalign   = dlsym(RTLD_NEXT, "memalign");
   myfn_mmap       = dlsym(RTLD_NEXT, "mmap");
   myfn_munmap     = dlsym(RTLD_NEXT, "munmap");
-  
-  if (!myfn_malloc || !myfn_free || !myfn_calloc || !myfn_realloc || !myfn_memalign || !myfn_mmap || !myfn_munmap ) 
+
+  if (!myfn_malloc || !myfn_free || !myfn_calloc || !myfn_realloc || !myfn_memalign || !myfn_mmap || !myfn_munmap )
     {
       fprintf(stderr, "Error in `dlsym`: %s\n", dlerror());
       exit(1);
     }
+
+  pthread_key_create(&ring_key, ring_release);
+  pthread_atfork(NULL, NULL, trace_atfork_child);
+  const char *sample_env = getenv("CM2_SAMPLE");
+  sample_rate = sample_env ? parse_size(sample_env) : 0;
+  if (sample_rate)
+    sample_init();
+  else
+    trace_open(0);
 }
 
 void *malloc(size_t size){
@@ -49,8 +592,6 @@ void *malloc(size_t size){
       initializing = 1;
       init();
       initializing = 0;
-      fprintf(stdout, "rMALLOC(%lu)\n", size);      
-      fprintf(stdout, "jcheck: allocated %lu bytes of temp memory in %lu chunks during initialization\n", tmppos, tmpallocs);
     }
     else {
       if (tmppos + size < sizeof(tmpbuff)) {
@@ -60,16 +601,15 @@ void *malloc(size_t size){
 	return retptr;
       }
       else {
-	fprintf(stdout, "jcheck: too much memory requested during initialisation - increase tmpbuff size\n");
+	fprintf(stderr, "jcheck: too much memory requested during initialisation - increase tmpbuff size\n");
 	exit(1);
       }
     }
   }
 
   void *ptr = myfn_malloc(size);
-  char buffer[50];
-  int len=sprintf(buffer,"rMALLOc (%ld) at %p\n",size,ptr);
-  write(1,buffer,len);
+  sample(ptr, size);
+  trace(CM2_OP_MALLOC, size, NULL, ptr);
   return ptr;
 }
 
@@ -77,22 +617,18 @@ void free(void *ptr){
   // something wrong if we call free before one of the allocators!
   //  if (myfn_malloc == NULL)
   //      init();
-  
-  if (ptr >= (void*) tmpbuff && ptr <= (void*)(tmpbuff + tmppos))
-    fprintf(stdout, "freeing temp memory\n");
-  else
-    myfn_free(ptr);
 
-  char buffer[50];
-  int len=sprintf(buffer,"rFREE at %p\n",ptr);
-  write(1,buffer,len);
+  if (ptr >= (void*) tmpbuff && ptr <= (void*)(tmpbuff + tmppos))
+    return; // temp memory is never reused
+  sample_free(ptr);
+  // Recorded before the block is released, so a malloc getting its address on
+  // another thread right after sorts behind this free
+  trace(CM2_OP_FREE, 0, ptr, NULL);
+  myfn_free(ptr);
 }
 
 void *realloc(void *ptr, size_t size)
 {
-  char buffer[70];
-  int len=sprintf(buffer,"rREALLOC-> (%ld) at %p \n",size,ptr);
-  write(1,buffer,len);
     if (myfn_malloc == NULL)
     {
         void *nptr = malloc(size);
@@ -104,11 +640,11 @@ void *realloc(void *ptr, size_t size)
         return nptr;
     }
 
+    sample_free(ptr);
+    uint64_t start = trace_fd >= 0 ? trace_clock() : 0; // Stamped before ptr is released, as in free
     void *nptr = myfn_realloc(ptr, size);
-
-
-    len=sprintf(buffer,"rREALLOC (%ld) at %p -> %p\n",size,ptr,nptr);
-    write(1,buffer,len);
+    sample(nptr, size);
+    trace_at(start, CM2_OP_REALLOC, size, ptr, nptr);
     return nptr;
 }
 
@@ -123,22 +659,16 @@ void *calloc(size_t nmemb, size_t size)
     }
 
     void *ptr = myfn_calloc(nmemb, size);
-
-    char buffer[70];
-    int len=sprintf(buffer,"rCALLOC (%ld,%ld) \n",nmemb, size);
-    write(1,buffer,len);
-    
+    sample(ptr, nmemb * size);
+    trace(CM2_OP_CALLOC, (uint64_t)nmemb * size, NULL, ptr);
     return ptr;
 }
 
 void *memalign(size_t blocksize, size_t bytes)
 {
     void *ptr = myfn_memalign(blocksize, bytes);
-
-    char buffer[70];
-    int len=sprintf(buffer,"rMEMALING (%ld, %ld) @ %p\n",blocksize, bytes,ptr);
-    write(1,buffer,len);
-    
+    sample(ptr, bytes);
+    trace(CM2_OP_MEMALIGN, bytes, (void *)blocksize, ptr);
     return ptr;
 }
 
@@ -150,8 +680,6 @@ void *mmap(void *ptr,  size_t length, int prot, int flags, int fd, off_t offset)
       initializing = 1;
       init();
       initializing = 0;
-      fprintf(stdout, "rMMAP(%lu)\n", length);      
-      fprintf(stdout, "jcheck: allocated %lu bytes of temp memory in %lu chunks during initialization\n", tmppos, tmpallocs);
     }
     else {
      if (tmppos + length < sizeof(tmpbuff)) {
@@ -161,30 +689,18 @@ void *mmap(void *ptr,  size_t length, int prot, int flags, int fd, off_t offset)
 	return retptr;
       }
       else {
-	fprintf(stdout, "jcheck: too much memory requested during initialisation - increase tmpbuff size\n");
+	fprintf(stderr, "jcheck: too much memory requested during initialisation - increase tmpbuff size\n");
 	exit(1);
       }
     }
   }
   void *ptr2 = myfn_mmap(ptr, length, prot, flags, fd, offset);
-    
-  char buffer[70];
-  int len=sprintf(buffer,"rMMAP (%ld) at %p\n", length, ptr2);
-  write(1,buffer,len);
-  
+  trace(CM2_OP_MMAP, length, ptr, ptr2);
   return ptr2;
 }
 
 
 int munmap(void *ptr, size_t length){
-  char buffer[70];
-  int len=sprintf(buffer,"rMUNMMAP-> (%p,%ld) => \n",ptr, length);
-  write(1,buffer,len);
-  
-  int resp=myfn_munmap(ptr, length);
-
-  len=sprintf(buffer,"rMUNMMAP (%p,%ld) => %d\n",ptr, length, resp);
-  write(1,buffer,len);
-
-  return resp;
-}
\ No newline at end of file
+  trace(CM2_OP_MUNMAP, length, ptr, NULL); // Before the range can be mapped again, as in free
+  return myfn_munmap(ptr, length);
+}
@@ -0,0 +1,118 @@
+// cm2_decode.c
+// Prints a binary trace written by the cM2.c interposer as text
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cm2_trace.h"
+
+typedef struct {
+    cm2_record record;
+    size_t index; // Position in the file, keeps the sort stable
+} indexed_record;
+
+static int compare_records(const void *a, const void *b)
+{
+    const indexed_record *left = a, *right = b;
+    if (left->record.timestamp != right->record.timestamp)
+        return left->record.timestamp < right->record.timestamp ? -1 : 1;
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+static void print_record(const cm2_record *r, uint64_t start)
+{
+    uint64_t t = r->timestamp - start;
+    printf("%" PRIu64 ".%09" PRIu64 " tid %u ", t / 1000000000, t % 1000000000, r->tid);
+    switch (r->op)
+    {
+    case CM2_OP_MALLOC:
+        printf("malloc(%" PRIu64 ") = 0x%" PRIx64 "\n", r->size, r->result);
+        break;
+    case CM2_OP_FREE:
+        printf("free(0x%" PRIx64 ")\n", r->ptr);
+        break;
+    case CM2_OP_REALLOC:
+        printf("realloc(0x%" PRIx64 ", %" PRIu64 ") = 0x%" PRIx64 "\n", r->ptr, r->size, r->result);
+        break;
+    case CM2_OP_CALLOC:
+        printf("calloc(%" PRIu64 ") = 0x%" PRIx64 "\n", r->size, r->result);
+        break;
+    case CM2_OP_MEMALIGN:
+        printf("memalign(%" PRIu64 ", %" PRIu64 ") = 0x%" PRIx64 "\n", r->ptr, r->size, r->result);
+        break;
+    case CM2_OP_MMAP:
+        printf("mmap(0x%" PRIx64 ", %" PRIu64 ") = 0x%" PRIx64 "\n", r->ptr, r->size, r->result);
+        break;
+    case CM2_OP_MUNMAP:
+        printf("munmap(0x%" PRIx64 ", %" PRIu64 ")\n", r->ptr, r->size);
+        break;
+    default:
+        printf("unknown op %u\n", r->op);
+        break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int sort = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s")) != -1)
+    {
+        if (opt == 's')
+            sort = 1;
+        else
+            break;
+    }
+    if (optind >= argc)
+    {
+        printf("Usage: %s [-s] <trace file>\n", argv[0]);
+        printf("  -s  print records in timestamp order instead of file order\n");
+        return 1;
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (!file)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    cm2_trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CM2_TRACE_MAGIC || header.record_size < sizeof(cm2_record))
+    {
+        fprintf(stderr, "%s: not a cM2 trace\n", argv[optind]);
+        fclose(file);
+        return 1;
+    }
+    printf("# trace of pid %" PRIu64 ", version %u\n", header.pid, header.version);
+
+    // Read every record; newer writers may append fields we skip over
+    size_t count = 0, capacity = 1024;
+    indexed_record *records = malloc(capacity * sizeof(*records));
+    char *raw = malloc(header.record_size);
+    uint64_t start = UINT64_MAX;
+    while (fread(raw, header.record_size, 1, file) == 1)
+    {
+        if (count == capacity)
+        {
+            capacity *= 2;
+            records = realloc(records, capacity * sizeof(*records));
+        }
+        memcpy(&records[count].record, raw, sizeof(cm2_record));
+        records[count].index = count;
+        if (records[count].record.timestamp < start)
+            start = records[count].record.timestamp;
+        count++;
+    }
+    fclose(file);
+
+    if (sort)
+        qsort(records, count, sizeof(*records), compare_records);
+    for (size_t i = 0; i < count; i++)
+        print_record(&records[i].record, start);
+    printf("# %zu records\n", count);
+
+    free(raw);
+    free(records);
+    return 0;
+}
@@ -0,0 +1,45 @@
+// cm2_trace.h
+// Binary trace format written by the cM2.c interposer (libmymalloc.so)
+#ifndef CM2_TRACE_H
+#define CM2_TRACE_H
+
+#include <stdint.h>
+
+#define CM2_TRACE_MAGIC 0x4543415254324d43ULL // "CM2TRACE"
+#define CM2_TRACE_VERSION 1
+
+// Operations recorded in a trace
+enum cm2_op {
+  CM2_OP_MALLOC = 1,
+  CM2_OP_FREE,
+  CM2_OP_REALLOC,
+  CM2_OP_CALLOC,
+  CM2_OP_MEMALIGN,
+  CM2_OP_MMAP,
+  CM2_OP_MUNMAP,
+};
+
+// Header at the start of every trace file
+typedef struct cm2_trace_header {
+  uint64_t magic;       // CM2_TRACE_MAGIC
+  uint32_t version;     // CM2_TRACE_VERSION
+  uint32_t record_size; // sizeof(cm2_record), lets readers skip unknown trailing fields
+  uint64_t pid;         // Process that wrote the trace
+} cm2_trace_header;
+
+// One intercepted call. Records of one thread appear in call order, but
+// records of different threads are interleaved in chunks; sort by
+// timestamp for a global order.
+typedef struct cm2_record {
+  uint64_t timestamp; // CLOCK_MONOTONIC nanoseconds when the call returned, or when
+                      // it was entered for free, realloc and munmap, so a release
+                      // sorts before any later allocation of the same address
+  uint64_t size;      // Bytes requested (nmemb * size for calloc, length for mmap/munmap)
+  uint64_t ptr;       // Pointer passed in (free, realloc, munmap), alignment for memalign
+  uint64_t result;    // Pointer returned (malloc, calloc, realloc, memalign, mmap)
+  uint32_t tid;       // Kernel thread ID of the caller
+  uint16_t op;        // enum cm2_op
+  uint16_t reserved;
+} cm2_record;
+
+#endif // CM2_TRACE_H
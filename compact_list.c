@@ -0,0 +1,199 @@
+// compact_list.c
+// List of 8-byte nodes: values linked by 32-bit pool offsets, carved out of
+// slabs, with one reader-writer lock per list instead of a mutex per node
+#include "linked_list.h"
+#include <errno.h>
+#include <stdalign.h>
+
+#define CLIST_SLAB_NODES 256 // Nodes carved out of one pool allocation
+
+// A node is its value and the pool offset of the next node, 0 for none; no
+// node sits at offset 0 because every slab starts with its header. A list
+// allocates its slabs under its tag and keeps them until clist_destroy, and
+// removed nodes wait on a free chain for the next add. An element so costs 8
+// bytes and a share of a slab header, against sizeof(Node) and the
+// allocator's per-block bookkeeping for a Node.
+
+typedef struct cnode {
+    uint32_t next; // Pool offset of the next node, 0 at the end
+    uint16_t data;
+} cnode;
+
+_Static_assert(sizeof(cnode) == 8, "a compact node is 8 bytes");
+
+typedef struct cslab {
+    struct cslab *next; // Slab allocated before this one
+} cslab;
+
+struct CompactList {
+    uint32_t head;   // First node, 0 when empty
+    uint32_t tail;   // Last node, 0 when empty
+    uint32_t free;   // Chain of removed nodes through their next
+    uint32_t carved; // Nodes handed out of the newest slab
+    size_t count;
+    cslab *slabs;    // Newest slab first
+    unsigned tag;    // Memory tag the list and its slabs are allocated under
+    pthread_rwlock_t lock;
+};
+
+static cnode *at(uint32_t offset) { return mem_at(offset); }
+
+// Nodes of a slab; the pool hands out blocks at any address, so round up past the header
+static cnode *slab_nodes(cslab *slab) {
+    uintptr_t start = (uintptr_t)(slab + 1);
+    return (cnode *)((start + alignof(cnode) - 1) & ~(uintptr_t)(alignof(cnode) - 1));
+}
+
+/// @brief Takes a node off the free chain or out of the newest slab, allocating
+/// a slab when both are used up; write lock held
+/// @return pool offset of the node, 0 if the pool is full
+static uint32_t alloc_node(CompactList *list) {
+    if (list->free) {
+        uint32_t node = list->free;
+        list->free = at(node)->next;
+        return node;
+    }
+    if (!list->slabs || list->carved == CLIST_SLAB_NODES) {
+        size_t size = sizeof(cslab) + alignof(cnode) - 1 + CLIST_SLAB_NODES * sizeof(cnode);
+        cslab *slab = mem_alloc_tagged(size, list->tag);
+        if (!slab) return 0;
+        if (mem_offset(slab) + size > UINT32_MAX) { // Out of reach of a 32-bit offset
+            mem_free(slab);
+            return 0;
+        }
+        slab->next = list->slabs;
+        list->slabs = slab;
+        list->carved = 0;
+    }
+    return (uint32_t)mem_offset(&slab_nodes(list->slabs)[list->carved++]);
+}
+
+/// @brief Creates an empty compact list in the pool, which mem_init or one of
+/// its variants must have set up; nodes are only reachable within the first 4 GiB
+/// @param tag memory tag for the list and its slabs
+/// @return the list, NULL with errno set if the pool is full or @p tag is out of range
+CompactList *clist_create(unsigned tag) {
+    if (tag >= MEM_TAG_COUNT) {
+        errno = EINVAL;
+        return NULL;
+    }
+    CompactList *list = mem_alloc_tagged(sizeof(CompactList), tag);
+    if (!list) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *list = (CompactList){.tag = tag};
+    int init_result = pthread_rwlock_init(&list->lock, NULL);
+    if (init_result != 0) {
+        mem_free(list);
+        errno = init_result;
+        return NULL;
+    }
+    return list;
+}
+
+/// @brief Frees the slabs and the list; no other thread may use it anymore
+/// @param list list from clist_create
+void clist_destroy(CompactList *list) {
+    for (cslab *slab = list->slabs; slab;) {
+        cslab *next = slab->next;
+        mem_free(slab);
+        slab = next;
+    }
+    pthread_rwlock_destroy(&list->lock);
+    mem_free(list);
+}
+
+/// @brief Appends a value
+/// @param list list
+/// @param data value to append
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full
+int clist_add(CompactList *list, uint16_t data) {
+    pthread_rwlock_wrlock(&list->lock);
+    uint32_t node = alloc_node(list);
+    if (!node) {
+        pthread_rwlock_unlock(&list->lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    *at(node) = (cnode){0, data};
+    if (list->tail) at(list->tail)->next = node;
+    else list->head = node;
+    list->tail = node;
+    list->count++;
+    pthread_rwlock_unlock(&list->lock);
+    return 0;
+}
+
+/// @brief Removes the first node holding @p data
+/// @param list list
+/// @param data value to remove
+/// @return 0 on success, -1 with errno set to ENOENT if no node holds it
+int clist_remove(CompactList *list, uint16_t data) {
+    pthread_rwlock_wrlock(&list->lock);
+    uint32_t prev = 0;
+    uint32_t node = list->head;
+    while (node && at(node)->data != data) {
+        prev = node;
+        node = at(node)->next;
+    }
+    if (!node) {
+        pthread_rwlock_unlock(&list->lock);
+        errno = ENOENT;
+        return -1;
+    }
+    uint32_t next = at(node)->next;
+    if (prev) at(prev)->next = next;
+    else list->head = next;
+    if (list->tail == node) list->tail = prev;
+    at(node)->next = list->free;
+    list->free = node;
+    list->count--;
+    pthread_rwlock_unlock(&list->lock);
+    return 0;
+}
+
+/// @brief Tells whether a node holds @p data
+/// @param list list
+/// @param data value to search for
+/// @return true if found
+bool clist_contains(CompactList *list, uint16_t data) {
+    pthread_rwlock_rdlock(&list->lock);
+    uint32_t node = list->head;
+    while (node && at(node)->data != data) node = at(node)->next;
+    pthread_rwlock_unlock(&list->lock);
+    return node != 0;
+}
+
+/// @brief returns the number of values
+/// @param list list
+/// @return size_t
+size_t clist_size(CompactList *list) {
+    pthread_rwlock_rdlock(&list->lock);
+    size_t count = list->count;
+    pthread_rwlock_unlock(&list->lock);
+    return count;
+}
+
+/// @brief Copies the values in list order
+/// @param list list
+/// @param values array receiving up to @p max values
+/// @param max capacity of @p values
+/// @return number of values copied
+size_t clist_copy(CompactList *list, uint16_t *values, size_t max) {
+    pthread_rwlock_rdlock(&list->lock);
+    size_t copied = 0;
+    for (uint32_t node = list->head; node && copied < max; node = at(node)->next) values[copied++] = at(node)->data;
+    pthread_rwlock_unlock(&list->lock);
+    return copied;
+}
+
+/// @brief displays all values
+/// @param list list
+void clist_print(CompactList *list) {
+    pthread_rwlock_rdlock(&list->lock);
+    printf("[");
+    for (uint32_t node = list->head; node; node = at(node)->next) printf(node == list->head ? "%d" : ", %d", at(node)->data);
+    printf("]");
+    pthread_rwlock_unlock(&list->lock);
+}
@@ -0,0 +1,77 @@
+// fixed_pool.h
+// Header-only pools for objects whose size is known at compile time
+#ifndef FIXED_POOL_H
+#define FIXED_POOL_H
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FIXED_POOL_PAUSE() __builtin_ia32_pause()
+#else
+#define FIXED_POOL_PAUSE() ((void)0)
+#endif
+
+/// @brief Defines a pool of @p capacity objects of @p type in static storage,
+/// with these functions:
+///
+///     type *name_alloc(void);          // NULL once all objects are in use
+///     void  name_free(type *object);   // NULL is ignored
+///     int   name_owns(const void *ptr);
+///
+/// Free objects form an intrusive list through their own storage, so
+/// allocating pops that list and freeing pushes onto it: no size arithmetic,
+/// no headers, and everything inlines into the caller instead of calling into
+/// libmemory_manager.so. Objects never handed out yet are taken in address
+/// order, so the pool needs no initialization. A spinlock held for a few
+/// instructions makes the functions thread-safe.
+///
+/// Use it at file scope in one translation unit; every expansion is a separate
+/// pool.
+#define DEFINE_FIXED_POOL(name, type, capacity)                                               \
+    _Static_assert((capacity) > 0, "fixed pool " #name " needs a capacity");                  \
+    typedef union name##_slot {                                                               \
+        type object;                                                                          \
+        union name##_slot *next; /* Next free slot while the slot is free */                  \
+    } name##_slot;                                                                            \
+    static name##_slot name##_slots[capacity];                                                \
+    static name##_slot *name##_free_list;       /* Slots that were freed, most recent first */\
+    static name##_slot *name##_unused = name##_slots; /* First slot never handed out */       \
+    static char name##_lock;                                                                  \
+                                                                                              \
+    static inline void name##_acquire(void) {                                                 \
+        while (__atomic_test_and_set(&name##_lock, __ATOMIC_ACQUIRE))                         \
+            while (__atomic_load_n(&name##_lock, __ATOMIC_RELAXED))                           \
+                FIXED_POOL_PAUSE();                                                           \
+    }                                                                                         \
+                                                                                              \
+    static inline void name##_release(void) {                                                 \
+        __atomic_clear(&name##_lock, __ATOMIC_RELEASE);                                       \
+    }                                                                                         \
+                                                                                              \
+    static inline type *name##_alloc(void) {                                                  \
+        name##_acquire();                                                                     \
+        name##_slot *slot = name##_free_list;                                                 \
+        if (slot)                                                                             \
+            name##_free_list = slot->next;                                                    \
+        else if (name##_unused < name##_slots + (capacity))                                   \
+            slot = name##_unused++;                                                           \
+        name##_release();                                                                     \
+        return slot ? &slot->object : NULL;                                                   \
+    }                                                                                         \
+                                                                                              \
+    static inline void name##_free(type *object) {                                            \
+        if (!object)                                                                          \
+            return;                                                                           \
+        name##_slot *slot = (name##_slot *)object;                                            \
+        name##_acquire();                                                                     \
+        slot->next = name##_free_list;                                                        \
+        name##_free_list = slot;                                                              \
+        name##_release();                                                                     \
+    }                                                                                         \
+                                                                                              \
+    static inline int name##_owns(const void *ptr) {                                          \
+        return (const char *)ptr >= (const char *)name##_slots &&                             \
+               (const char *)ptr < (const char *)(name##_slots + (capacity));                 \
+    }
+
+#endif // FIXED_POOL_H
@@ -1,15 +1,401 @@
 #define _GNU_SOURCE
 #include "linked_list.h"
+#include <errno.h>
+#include <string.h>
 
-pthread_rwlock_t lock;
+// Where a value sits in a list with a value index, see list_index
+typedef struct index_entry {
+    Node* first;    // First node holding the value, NULL if none does
+    Node* before;   // Node linking to first, NULL when first is the head
+    uint32_t count; // Nodes holding the value
+} index_entry;
+
+#define INDEX_ENTRIES (UINT16_MAX + 1)
+#define LIST_BATCH 256 // Nodes the bulk operations allocate or free per call into the memory manager
+
+struct List {
+    Node** head;               // Where the first node pointer lives: &first, or the caller's variable for the Node** functions
+    Node* first;
+    Node* tail;                // Last node or NULL when unknown, kept under LIST_LOCK_GLOBAL so list_add need not walk
+    size_t count;              // Nodes in the list, updated atomically
+    list_locking locking;
+    unsigned tag;              // Memory tag the nodes are allocated under
+    index_entry* index;        // One entry per value once list_index built it, else NULL
+    pthread_rwlock_t lock;     // Guards the list under LIST_LOCK_GLOBAL
+    pthread_mutex_t head_lock; // Guards *head under LIST_LOCK_COUPLING
+};
+
+// The list behind the Node** functions, set up by list_init
+static List legacy_;
+
+// With LIST_LOCK_COUPLING every node's mutex guards its next pointer. A walk
+// holds at most two locks: it locks the next node before letting go of the
+// current one, so no node can be unlinked or inserted behind it meanwhile,
+// and head_lock stands in for the predecessor of the first node. Deleting a
+// node holds both its predecessor and the node itself.
+
+/// @brief Allocates a node under the list's tag
+/// @param list list the node is for
+/// @param data data for the new node
+/// @return Node* or NULL if the pool is full
+static Node* alloc_node(List* list, uint16_t data) {
+    Node* new_node = mem_alloc_tagged(sizeof(Node), list->tag);
+    if (!new_node) return NULL;
+    new_node->data = data;
+    new_node->next = NULL;
+    if (list->locking == LIST_LOCK_COUPLING) pthread_mutex_init(&new_node->lock, NULL);
+    return new_node;
+}
+
+static void free_node(List* list, Node* node) {
+    if (list->locking == LIST_LOCK_COUPLING) pthread_mutex_destroy(&node->lock);
+    mem_free(node);
+}
+
+/// @brief Frees a chain of nodes no other thread can reach anymore, in batches
+/// @param list list the nodes were allocated for
+/// @param node first node of the chain
+static void free_chain(List* list, Node* node) {
+    void* batch[LIST_BATCH];
+    size_t count = 0;
+    while (node) {
+        Node* next = node->next;
+        if (list->locking == LIST_LOCK_COUPLING) pthread_mutex_destroy(&node->lock);
+        batch[count++] = node;
+        if (count == LIST_BATCH) {
+            mem_free_batch(batch, count);
+            count = 0;
+        }
+        node = next;
+    }
+    mem_free_batch(batch, count);
+}
+
+/// @brief Allocates nodes for @p values in batches and links them in order, no list lock needed
+/// @param list list the nodes are for
+/// @param values values of the nodes
+/// @param n number of values, at least 1
+/// @param last set to the last node of the chain
+/// @return first node of the chain, NULL if the pool is full
+static Node* alloc_chain(List* list, const uint16_t* values, size_t n, Node** last) {
+    void* batch[LIST_BATCH];
+    Node* first = NULL;
+    Node* prev = NULL;
+    for (size_t done = 0; done < n;) {
+        size_t take = n - done < LIST_BATCH ? n - done : LIST_BATCH;
+        if (mem_alloc_batch(sizeof(Node), take, batch, list->tag) != 0) {
+            free_chain(list, first);
+            return NULL;
+        }
+        for (size_t i = 0; i < take; i++) {
+            Node* node = batch[i];
+            node->data = values[done + i];
+            node->next = NULL;
+            if (list->locking == LIST_LOCK_COUPLING) pthread_mutex_init(&node->lock, NULL);
+            if (prev) prev->next = node;
+            else first = node;
+            prev = node;
+        }
+        done += take;
+    }
+    *last = prev;
+    return first;
+}
+
+static void count_add(List* list) { __atomic_fetch_add(&list->count, 1, __ATOMIC_RELAXED); }
+
+static void count_sub(List* list) { __atomic_fetch_sub(&list->count, 1, __ATOMIC_RELAXED); }
+
+// The index keeps, besides the first node of every value, the node before
+// it, so list_remove unlinks without a walk. Linking or unlinking a node
+// changes the predecessor of one node only, its successor, and that one is
+// looked up by its own value. Only finding the next occurrence of a removed
+// first node, or whether a node inserted ahead of the end comes before the
+// first one, takes a walk, and only for values held more than once.
+
+/// @brief Records that @p prev now links to @p node; write lock held
+static void index_relink(List* list, Node* prev, Node* node) {
+    if (node && list->index[node->data].first == node) list->index[node->data].before = prev;
+}
+
+/// @brief Adds @p node, just linked in behind @p prev, to the index; write lock held
+static void index_insert(List* list, Node* prev, Node* node) {
+    index_entry* entry = &list->index[node->data];
+    index_relink(list, node, node->next);
+    if (entry->count++ == 0) {
+        *entry = (index_entry){node, prev, 1};
+        return;
+    }
+    // node is the new first if the old one is behind it
+    for (Node* walker = node->next; walker; walker = walker->next) {
+        if (walker == entry->first) {
+            entry->first = node;
+            entry->before = prev;
+            return;
+        }
+    }
+}
+
+/// @brief Adds the nodes from @p node to the end, which just got linked in
+/// behind @p prev, to the index; none of their values comes later. Write lock held
+static void index_append(List* list, Node* prev, Node* node) {
+    for (; node; prev = node, node = node->next) {
+        index_entry* entry = &list->index[node->data];
+        if (entry->count++ == 0) {
+            entry->first = node;
+            entry->before = prev;
+        }
+    }
+}
+
+/// @brief Drops @p node, just unlinked from behind @p prev, from the index; write lock held
+static void index_remove(List* list, Node* prev, Node* node) {
+    index_entry* entry = &list->index[node->data];
+    index_relink(list, prev, node->next);
+    if (--entry->count == 0) {
+        entry->first = entry->before = NULL;
+    } else if (entry->first == node) {
+        Node* walker = node->next;
+        while (walker->data != node->data) {
+            prev = walker;
+            walker = walker->next;
+        }
+        entry->first = walker;
+        entry->before = prev;
+    }
+}
+
+/// @brief Locks the first node and lets go of head_lock, which the caller holds
+/// @param list list
+/// @return the locked first node, NULL with head_lock released if the list is empty
+static Node* coupled_first(List* list) {
+    Node* first = *list->head;
+    if (first) pthread_mutex_lock(&first->lock);
+    pthread_mutex_unlock(&list->head_lock);
+    return first;
+}
+
+/// @brief Moves the walk one node on: locks the next node, then unlocks @p node
+/// @param node locked node
+/// @return the locked next node, NULL at the end of the list
+static Node* coupled_step(Node* node) {
+    Node* next = node->next;
+    if (next) pthread_mutex_lock(&next->lock);
+    pthread_mutex_unlock(&node->lock);
+    return next;
+}
+
+static void coupled_insert(List* list, Node* new_node) {
+    pthread_mutex_lock(&list->head_lock);
+    if (*list->head == NULL) {
+        *list->head = new_node;
+        pthread_mutex_unlock(&list->head_lock);
+        return;
+    }
+    Node* walker = coupled_first(list);
+    while (walker->next) walker = coupled_step(walker);
+    walker->next = new_node;
+    pthread_mutex_unlock(&walker->lock);
+}
+
+static void coupled_insert_after(Node* prev_node, Node* new_node) {
+    pthread_mutex_lock(&prev_node->lock);
+    new_node->next = prev_node->next;
+    prev_node->next = new_node;
+    pthread_mutex_unlock(&prev_node->lock);
+}
+
+static int coupled_insert_before(List* list, Node* next_node, Node* new_node) {
+    new_node->next = next_node;
+    pthread_mutex_lock(&list->head_lock);
+    if (*list->head != NULL && *list->head == next_node) {
+        *list->head = new_node;
+        pthread_mutex_unlock(&list->head_lock);
+        return 0;
+    }
+    Node* walker = coupled_first(list);
+    while (walker && walker->next != next_node) walker = coupled_step(walker);
+    if (walker == NULL) return -1; // next_node is not in the list
+    walker->next = new_node;
+    pthread_mutex_unlock(&walker->lock);
+    return 0;
+}
+
+static Node* coupled_delete(List* list, uint16_t data) {
+    pthread_mutex_lock(&list->head_lock);
+    Node* first = *list->head;
+    if (first == NULL) {
+        pthread_mutex_unlock(&list->head_lock);
+        return NULL;
+    }
+    pthread_mutex_lock(&first->lock);
+    if (first->data == data) {
+        *list->head = first->next;
+        pthread_mutex_unlock(&first->lock);
+        pthread_mutex_unlock(&list->head_lock);
+        return first;
+    }
+    pthread_mutex_unlock(&list->head_lock);
+
+    // Hold the predecessor and the candidate, so the candidate can be unlinked
+    Node* prev = first;
+    Node* walker = prev->next;
+    while (walker) {
+        pthread_mutex_lock(&walker->lock);
+        if (walker->data == data) {
+            prev->next = walker->next;
+            pthread_mutex_unlock(&walker->lock);
+            pthread_mutex_unlock(&prev->lock);
+            return walker;
+        }
+        pthread_mutex_unlock(&prev->lock);
+        prev = walker;
+        walker = walker->next;
+    }
+    pthread_mutex_unlock(&prev->lock);
+    return NULL;
+}
+
+/// @brief Unlinks every node holding @p data in one hand-over-hand pass
+/// @param removed set to the chain of unlinked nodes
+/// @return number of nodes unlinked
+static size_t coupled_delete_all(List* list, uint16_t data, Node** removed) {
+    Node** removed_end = removed;
+    size_t count = 0;
+    *removed = NULL;
+    pthread_mutex_lock(&list->head_lock);
+    Node* first;
+    while ((first = *list->head) != NULL) { // Matches at the front hang off head_lock
+        pthread_mutex_lock(&first->lock);
+        if (first->data != data) break;
+        *list->head = first->next;
+        pthread_mutex_unlock(&first->lock);
+        first->next = NULL;
+        *removed_end = first;
+        removed_end = &first->next;
+        count++;
+    }
+    pthread_mutex_unlock(&list->head_lock);
+    if (!first) return count;
+
+    // Hold the last node kept and the candidate, like coupled_delete
+    Node* prev = first;
+    Node* walker = prev->next;
+    while (walker) {
+        pthread_mutex_lock(&walker->lock);
+        Node* next = walker->next;
+        if (walker->data == data) {
+            prev->next = next;
+            pthread_mutex_unlock(&walker->lock);
+            walker->next = NULL;
+            *removed_end = walker;
+            removed_end = &walker->next;
+            count++;
+        } else {
+            pthread_mutex_unlock(&prev->lock);
+            prev = walker;
+        }
+        walker = next;
+    }
+    pthread_mutex_unlock(&prev->lock);
+    return count;
+}
+
+/// @brief Frees a chain detached from the head, behind any walker still on it:
+/// the next node is locked before a node is freed
+static void coupled_drain(List* list, Node* node) {
+    if (node) pthread_mutex_lock(&node->lock);
+    while (node) {
+        Node* next = coupled_step(node);
+        free_node(list, node);
+        node = next;
+    }
+}
+
+static Node* coupled_search(List* list, uint16_t data) {
+    pthread_mutex_lock(&list->head_lock);
+    Node* walker = coupled_first(list);
+    while (walker && walker->data != data) walker = coupled_step(walker);
+    if (walker) pthread_mutex_unlock(&walker->lock);
+    return walker;
+}
+
+static void coupled_display_range(List* list, Node* start_node, Node* end_node) {
+    Node* walker;
+    if (start_node) {
+        walker = start_node;
+        pthread_mutex_lock(&walker->lock);
+    } else {
+        pthread_mutex_lock(&list->head_lock);
+        walker = coupled_first(list);
+    }
+    printf("[");
+    while (walker) {
+        printf("%d", walker->data);
+        if (walker == end_node || walker->next == NULL) {
+            pthread_mutex_unlock(&walker->lock);
+            break;
+        }
+        printf(", ");
+        walker = coupled_step(walker);
+    }
+    printf("]");
+}
+
+static int coupled_count_nodes(List* list) {
+    pthread_mutex_lock(&list->head_lock);
+    int counter = 0;
+    for (Node* walker = coupled_first(list); walker; walker = coupled_step(walker)) counter++;
+    return counter;
+}
+
+/// @brief Sets up the locks and state of a list whose first node pointer is at @p head
+/// @return 0 or the error of the failed pthread call
+static int setup(List* list, Node** head, list_locking locking, unsigned tag) {
+    *head = NULL;
+    list->head = head;
+    list->first = NULL;
+    list->tail = NULL;
+    list->count = 0;
+    list->locking = locking;
+    list->tag = tag;
+    list->index = NULL;
+    int init_result = pthread_rwlock_init(&list->lock, NULL);
+    if (init_result != 0) return init_result;
+    init_result = pthread_mutex_init(&list->head_lock, NULL);
+    if (init_result != 0) pthread_rwlock_destroy(&list->lock);
+    return init_result;
+}
+
+/// @brief The legacy list, following the caller if it passes another head variable
+/// @param head list head
+static List* legacy(Node** head) {
+    if (legacy_.head != head) {
+        legacy_.head = head;
+        legacy_.tail = NULL;
+        if (legacy_.index) { // It described the nodes of the previous head
+            mem_free(legacy_.index);
+            legacy_.index = NULL;
+        }
+    }
+    return &legacy_;
+}
 
 /// @brief Initializes the list
 /// @param head list head
 void list_init(Node** head, size_t size) {
+    list_init_locking(head, size, LIST_LOCK_GLOBAL);
+}
+
+/// @brief Initializes the list with a choice of synchronization
+/// @param head list head
+/// @param size bytes of the pool the nodes are allocated from
+/// @param locking LIST_LOCK_GLOBAL or LIST_LOCK_COUPLING
+void list_init_locking(Node** head, size_t size, list_locking locking) {
     mem_init(size);
-    *head = NULL;
-    int init_result = pthread_rwlock_init(&lock, NULL);
+    int init_result = setup(&legacy_, head, locking, 0);
     if (init_result != 0) {
+        errno = init_result;
         perror("pthread_rwlock_init failed");
         exit(EXIT_FAILURE);
     }
@@ -18,143 +404,343 @@ void list_init(Node** head, size_t size) {
 /// @brief inserts last in linked list
 /// @param head list head
 /// @param data data for the new node
-void list_insert(Node** head, uint16_t data) {
-    Node* new_node = mem_alloc(sizeof(Node));
-    if (!new_node) {
-        return;
+void list_insert(Node** head, uint16_t data) { list_add(legacy(head), data); }
+
+/// @brief Inserts a node after prev_node
+/// @param prev_nodenode that will be before new node
+/// @param data data for the new node
+void list_insert_after(Node* prev_node, uint16_t data) { list_add_after(&legacy_, prev_node, data); }
+
+/// @brief inserts before a node
+/// @param head list head
+/// @param next_node node that will be after new node
+/// @param data data for the new node
+void list_insert_before(Node** head, Node* next_node, uint16_t data) { list_add_before(legacy(head), next_node, data); }
+
+/// @brief deletes the Node with data
+/// @param head list head
+/// @param data
+void list_delete(Node** head, uint16_t data) { list_remove(legacy(head), data); }
+
+/// @brief return the pointer to node with data or NULL if not found
+/// @param head list head
+/// @param data value to search for
+/// @return Node* or NULL if node not found
+Node* list_search(Node** head, uint16_t data) { return list_find(legacy(head), data); }
+
+/// @brief displays all nodes
+/// @param head list head
+void list_display(Node** head) { list_display_range(head, NULL, NULL); }
+
+/// @brief Displays the nodes in the range, including start and end
+/// @param head list head
+/// @param start_node first node to display
+/// @param end_node last node to display
+void list_display_range(Node** head, Node* start_node, Node* end_node) { list_print_range(legacy(head), start_node, end_node); }
+
+/// @brief returns the number of nodes
+/// @param head list head
+/// @return int
+int list_count_nodes(Node** head) {
+    List* list = legacy(head);
+    if (list->locking == LIST_LOCK_COUPLING) return coupled_count_nodes(list);
+    pthread_rwlock_rdlock(&list->lock);
+    Node* walker = *head;
+    int counter = 0;
+    while (walker != NULL) {
+        counter++;
+        walker = walker->next;
     }
-    new_node->data = data;
-    new_node->next = NULL;
-    pthread_rwlock_wrlock(&lock);
-    if (*head == NULL) {
-        *head = new_node;
-        pthread_rwlock_unlock(&lock);
+    pthread_rwlock_unlock(&list->lock);
+    return counter;
+}
+
+/// @brief frees all used memory
+/// @param head list head
+void list_cleanup(Node** head) {
+    *head = NULL;
+    legacy_.head = NULL;
+    legacy_.tail = NULL;
+    legacy_.index = NULL; // Goes with the pool
+    mem_deinit();
+    pthread_rwlock_destroy(&legacy_.lock);
+    pthread_mutex_destroy(&legacy_.head_lock);
+}
+
+/// @brief Creates an empty list in the pool, which mem_init or one of its
+/// variants must have set up; the list lives until list_destroy or mem_deinit
+/// @param locking LIST_LOCK_GLOBAL or LIST_LOCK_COUPLING
+/// @param tag memory tag for the list and its nodes, so mem_tag_stats reports its usage
+/// @return the list, NULL with errno set if the pool is full or @p tag is out of range
+List* list_create(list_locking locking, unsigned tag) {
+    if (tag >= MEM_TAG_COUNT) {
+        errno = EINVAL;
+        return NULL;
+    }
+    List* list = mem_alloc_tagged(sizeof(List), tag);
+    if (!list) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    int init_result = setup(list, &list->first, locking, tag);
+    if (init_result != 0) {
+        mem_free(list);
+        errno = init_result;
+        return NULL;
+    }
+    return list;
+}
+
+/// @brief Frees the nodes of @p list and the list itself; no other thread may use it anymore
+/// @param list list from list_create
+void list_destroy(List* list) {
+    Node* walker = *list->head;
+    while (walker) {
+        Node* next = walker->next;
+        free_node(list, walker);
+        walker = next;
+    }
+    if (list->index) mem_free(list->index);
+    pthread_rwlock_destroy(&list->lock);
+    pthread_mutex_destroy(&list->head_lock);
+    mem_free(list);
+}
+
+/// @brief Appends a node: under LIST_LOCK_GLOBAL behind the tail, with the write
+/// lock held only to link it, under LIST_LOCK_COUPLING after a walk from the head
+/// @param list list
+/// @param data data for the new node
+void list_add(List* list, uint16_t data) {
+    Node* new_node = alloc_node(list, data);
+    if (!new_node) return;
+    if (list->locking == LIST_LOCK_COUPLING) {
+        coupled_insert(list, new_node);
+        count_add(list);
         return;
     }
-    Node* walker = *head;
-    while (walker->next) {
-        walker = walker->next;
+    pthread_rwlock_wrlock(&list->lock);
+    Node* walker = NULL;
+    if (*list->head == NULL) {
+        *list->head = new_node;
+    } else {
+        // Start at the tail; the walk only covers nodes list_add_after put behind it
+        walker = list->tail ? list->tail : *list->head;
+        while (walker->next) {
+            walker = walker->next;
+        }
+        walker->next = new_node;
     }
-    walker->next = new_node;
-    pthread_rwlock_unlock(&lock);
-    return;
+    list->tail = new_node;
+    if (list->index) index_insert(list, walker, new_node);
+    count_add(list);
+    pthread_rwlock_unlock(&list->lock);
 }
 
 /// @brief Inserts a node after prev_node
-/// @param prev_nodenode that will be before new node
+/// @param list list holding prev_node
+/// @param prev_node node that will be before new node
 /// @param data data for the new node
-void list_insert_after(Node* prev_node, uint16_t data) {
+void list_add_after(List* list, Node* prev_node, uint16_t data) {
     if (prev_node == NULL) return;
-    Node* new_node = mem_alloc(sizeof(Node));
+    Node* new_node = alloc_node(list, data);
     if (!new_node) return;
-    pthread_rwlock_wrlock(&lock);
+    if (list->locking == LIST_LOCK_COUPLING) {
+        coupled_insert_after(prev_node, new_node);
+        count_add(list);
+        return;
+    }
+    pthread_rwlock_wrlock(&list->lock);
     new_node->next = prev_node->next;
-    new_node->data = data;
     prev_node->next = new_node;
-    pthread_rwlock_unlock(&lock);
+    if (prev_node == list->tail) list->tail = new_node;
+    if (list->index) index_insert(list, prev_node, new_node);
+    count_add(list);
+    pthread_rwlock_unlock(&list->lock);
 }
 
-/// @brief inserts before a node
-/// @param head list head
+/// @brief Inserts a node before next_node, nothing if next_node is not in the list
+/// @param list list
 /// @param next_node node that will be after new node
 /// @param data data for the new node
-void list_insert_before(Node** head, Node* next_node, uint16_t data) {
-    pthread_rwlock_wrlock(&lock);
-    if (*head == NULL) {
-        return;  // ERROR
-        pthread_rwlock_unlock(&lock);
-    }
-    Node* new_node = mem_alloc(sizeof(Node));
-    if (!new_node) {
-        pthread_rwlock_unlock(&lock);
+void list_add_before(List* list, Node* next_node, uint16_t data) {
+    Node* new_node = alloc_node(list, data);
+    if (!new_node) return;
+    if (list->locking == LIST_LOCK_COUPLING) {
+        if (coupled_insert_before(list, next_node, new_node) != 0) free_node(list, new_node);
+        else count_add(list);
         return;
     }
+    pthread_rwlock_wrlock(&list->lock);
+    if (*list->head == NULL) {
+        pthread_rwlock_unlock(&list->lock);
+        free_node(list, new_node);
+        return;  // ERROR
+    }
 
-    if (next_node == *head) {
-        new_node->data = data;
-        new_node->next = *head;
-        *head = new_node;
-        pthread_rwlock_unlock(&lock);
+    if (next_node == *list->head) {
+        new_node->next = *list->head;
+        *list->head = new_node;
+        if (list->index) index_insert(list, NULL, new_node);
+        count_add(list);
+        pthread_rwlock_unlock(&list->lock);
         return;
     }
 
-    Node* walker = *head;
+    Node* walker = *list->head;
     while (walker->next != next_node && walker->next != NULL) {
         walker = walker->next;
     }
     if (walker->next == NULL) {
-        pthread_rwlock_unlock(&lock);
-        mem_free(new_node);
+        pthread_rwlock_unlock(&list->lock);
+        free_node(list, new_node);
         return;  // ERRROR
     }
     walker->next = new_node;
-    walker->next->next = next_node;
-    walker->next->data = data;
-    pthread_rwlock_unlock(&lock);
-    return;
+    new_node->next = next_node;
+    if (list->index) index_insert(list, walker, new_node);
+    count_add(list);
+    pthread_rwlock_unlock(&list->lock);
 }
 
-/// @brief deletes the Node with data
-/// @param head list head
-/// @param data
-void list_delete(Node** head, uint16_t data) {
-    pthread_rwlock_wrlock(&lock);
-    if (*head == NULL){
-        pthread_rwlock_unlock(&lock);
+/// @brief deletes the first Node with data
+/// @param list list
+/// @param data value to delete
+void list_remove(List* list, uint16_t data) {
+    if (list->locking == LIST_LOCK_COUPLING) {
+        Node* removed = coupled_delete(list, data);
+        if (removed) {
+            count_sub(list);
+            free_node(list, removed);
+        }
         return;
     }
-    if ((*head)->data == data) {
-        Node* temp = *head;
-        *head = (*head)->next;
-        mem_free(temp);
-        pthread_rwlock_unlock(&lock);
+    pthread_rwlock_wrlock(&list->lock);
+    if (*list->head == NULL) {
+        pthread_rwlock_unlock(&list->lock);
         return;
     }
-    Node* walker = *head;
-    while (walker->next != NULL && walker->next->data != data) {
-        walker = walker->next;
-    }
-    if (walker->next == NULL) {
-        pthread_rwlock_unlock(&lock);
-        return;
+    Node* temp = *list->head;
+    Node* walker = NULL;
+    if (list->index) { // The index names the node and the one linking to it
+        temp = list->index[data].first;
+        walker = list->index[data].before;
+        if (!temp) {
+            pthread_rwlock_unlock(&list->lock);
+            return;
+        }
+    } else if (temp->data != data) {
+        walker = *list->head;
+        while (walker->next != NULL && walker->next->data != data) {
+            walker = walker->next;
+        }
+        if (walker->next == NULL) {
+            pthread_rwlock_unlock(&list->lock);
+            return;
+        }
+        temp = walker->next;
     }
-    Node* temp = walker->next;
-    walker->next = temp->next;
-    mem_free(temp);
-    pthread_rwlock_unlock(&lock);
-    return;
+    if (walker) walker->next = temp->next;
+    else *list->head = temp->next;
+    if (temp == list->tail) list->tail = walker;
+    if (list->index) index_remove(list, walker, temp);
+    count_sub(list);
+    pthread_rwlock_unlock(&list->lock);
+    free_node(list, temp);
 }
 
-/// @brief return the pointer to node with data or NULL if not found
-/// @param head list head
+/// @brief return the pointer to the first node with data or NULL if not found
+/// @param list list
 /// @param data value to search for
 /// @return Node* or NULL if node not found
-Node* list_search(Node** head, uint16_t data) {
-    pthread_rwlock_rdlock(&lock);
-    Node* walker = *head;
-    while (walker != NULL) {
-        if (walker->data == data) {
-            pthread_rwlock_unlock(&lock);
-            return walker;
-        }
+Node* list_find(List* list, uint16_t data) {
+    if (list->locking == LIST_LOCK_COUPLING) return coupled_search(list, data);
+    pthread_rwlock_rdlock(&list->lock);
+    Node* walker = list->index ? list->index[data].first : *list->head;
+    while (walker != NULL && walker->data != data) {
         walker = walker->next;
     }
-    pthread_rwlock_unlock(&lock);
-    return NULL;
+    pthread_rwlock_unlock(&list->lock);
+    return walker;
+}
+
+/// @brief Counts the nodes holding @p data, O(1) with a value index
+/// @param list list
+/// @param data value to count
+/// @return number of nodes holding it
+size_t list_count_value(List* list, uint16_t data) {
+    if (list->locking == LIST_LOCK_COUPLING) {
+        pthread_mutex_lock(&list->head_lock);
+        size_t counter = 0;
+        for (Node* walker = coupled_first(list); walker; walker = coupled_step(walker)) counter += walker->data == data;
+        return counter;
+    }
+    pthread_rwlock_rdlock(&list->lock);
+    size_t counter = 0;
+    if (list->index) counter = list->index[data].count;
+    else
+        for (Node* walker = *list->head; walker; walker = walker->next) counter += walker->data == data;
+    pthread_rwlock_unlock(&list->lock);
+    return counter;
+}
+
+/// @brief Builds an index from every value to its first node and number of
+/// nodes, which every operation keeps up to date from then on. list_find,
+/// list_remove and list_count_value become O(1), whatever the length of the
+/// list; inserting a value the list already holds ahead of the end, or
+/// removing the first of several, walks up to the next one. The index takes
+/// 1.5 MiB of the pool under the list's tag and goes with list_destroy.
+/// @param list list with LIST_LOCK_GLOBAL
+/// @return 0 on success or if there already is an index, -1 with errno set to
+/// EINVAL for a LIST_LOCK_COUPLING list or ENOMEM if the pool is full
+int list_index(List* list) {
+    if (list->locking != LIST_LOCK_GLOBAL) {
+        errno = EINVAL;
+        return -1;
+    }
+    index_entry* index = mem_alloc_tagged(INDEX_ENTRIES * sizeof(index_entry), list->tag);
+    if (!index) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memset(index, 0, INDEX_ENTRIES * sizeof(index_entry));
+    pthread_rwlock_wrlock(&list->lock);
+    if (list->index) { // Another thread was first
+        pthread_rwlock_unlock(&list->lock);
+        mem_free(index);
+        return 0;
+    }
+    list->index = index;
+    index_append(list, NULL, *list->head);
+    pthread_rwlock_unlock(&list->lock);
+    return 0;
 }
 
+/// @brief returns the first node, to walk the list through next while no other thread changes it
+/// @param list list
+/// @return Node* or NULL if the list is empty
+Node* list_first(List* list) { return __atomic_load_n(list->head, __ATOMIC_ACQUIRE); }
+
+/// @brief returns the number of nodes, kept up to date by every operation instead of counted
+/// @param list list
+/// @return size_t
+size_t list_size(List* list) { return __atomic_load_n(&list->count, __ATOMIC_RELAXED); }
+
 /// @brief displays all nodes
-/// @param head list head
-void list_display(Node** head) { list_display_range(head, NULL, NULL); }
+/// @param list list
+void list_print(List* list) { list_print_range(list, NULL, NULL); }
 
 /// @brief Displays the nodes in the range, including start and end
-/// @param head list head
+/// @param list list
 /// @param start_node first node to display
 /// @param end_node last node to display
-void list_display_range(Node** head, Node* start_node, Node* end_node) {
-    pthread_rwlock_rdlock(&lock);
+void list_print_range(List* list, Node* start_node, Node* end_node) {
+    if (list->locking == LIST_LOCK_COUPLING) {
+        coupled_display_range(list, start_node, end_node);
+        return;
+    }
+    pthread_rwlock_rdlock(&list->lock);
     if (end_node) end_node = end_node->next;
-    if (!start_node) start_node = *head;
+    if (!start_node) start_node = *list->head;
     printf("[");
     while (start_node != NULL && start_node != end_node) {
         printf("%d", start_node->data);
@@ -162,28 +748,290 @@ void list_display_range(Node** head, Node* start_node, Node* end_node) {
         if (start_node && start_node != end_node) printf(", ");
     }
     printf("]");
-    pthread_rwlock_unlock(&lock);
+    pthread_rwlock_unlock(&list->lock);
 }
 
-/// @brief returns the number of nodes
-/// @param head list head
-/// @return int
-int list_count_nodes(Node** head) {
-    pthread_rwlock_rdlock(&lock);
-    Node* walker = *head;
-    int counter = 0;
-    while (walker != NULL) {
-        counter++;
-        walker = walker->next;
+/// @brief Appends @p n values; the nodes are allocated in batches before the
+/// list is locked, then linked in behind the tail at once
+/// @param list list
+/// @param values values to append in order
+/// @param n number of values
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full, in
+/// which case nothing is appended
+int list_add_bulk(List* list, const uint16_t* values, size_t n) {
+    if (n == 0) return 0;
+    Node* last;
+    Node* chain = alloc_chain(list, values, n, &last);
+    if (!chain) {
+        errno = ENOMEM;
+        return -1;
     }
-    pthread_rwlock_unlock(&lock);
-    return counter;
+    if (list->locking == LIST_LOCK_COUPLING) {
+        coupled_insert(list, chain);
+        __atomic_fetch_add(&list->count, n, __ATOMIC_RELAXED);
+        return 0;
+    }
+    pthread_rwlock_wrlock(&list->lock);
+    Node* walker = NULL;
+    if (*list->head == NULL) {
+        *list->head = chain;
+    } else {
+        walker = list->tail ? list->tail : *list->head;
+        while (walker->next) {
+            walker = walker->next;
+        }
+        walker->next = chain;
+    }
+    list->tail = last;
+    if (list->index) index_append(list, walker, chain);
+    __atomic_fetch_add(&list->count, n, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&list->lock);
+    return 0;
 }
 
-/// @brief frees all used memory
+/// @brief Removes every node holding @p data in one pass, with the index
+/// starting at the first of them and stopping after the last; the nodes are
+/// freed in batches once the list is unlocked
+/// @param list list
+/// @param data value to remove
+/// @return number of nodes removed
+size_t list_remove_all(List* list, uint16_t data) {
+    Node* removed = NULL;
+    size_t count = 0;
+    if (list->locking == LIST_LOCK_COUPLING) {
+        count = coupled_delete_all(list, data, &removed);
+    } else {
+        Node** removed_end = &removed;
+        pthread_rwlock_wrlock(&list->lock);
+        Node* prev = NULL;
+        Node* node = *list->head;
+        size_t expected = SIZE_MAX;
+        if (list->index) {
+            prev = list->index[data].before;
+            node = list->index[data].first;
+            expected = list->index[data].count;
+            list->index[data] = (index_entry){NULL, NULL, 0};
+        }
+        while (node && count < expected) {
+            Node* next = node->next;
+            if (node->data == data) {
+                if (prev) prev->next = next;
+                else *list->head = next;
+                if (node == list->tail) list->tail = prev;
+                if (list->index) index_relink(list, prev, next);
+                node->next = NULL;
+                *removed_end = node;
+                removed_end = &node->next;
+                count++;
+            } else {
+                prev = node;
+            }
+            node = next;
+        }
+        pthread_rwlock_unlock(&list->lock);
+    }
+    __atomic_fetch_sub(&list->count, count, __ATOMIC_RELAXED);
+    free_chain(list, removed);
+    return count;
+}
+
+/// @brief Copies the values in list order, in one pass under the read lock
+/// @param list list
+/// @param values array receiving up to @p max values
+/// @param max capacity of @p values
+/// @return number of values copied
+size_t list_copy(List* list, uint16_t* values, size_t max) {
+    size_t copied = 0;
+    if (list->locking == LIST_LOCK_COUPLING) {
+        pthread_mutex_lock(&list->head_lock);
+        Node* walker = coupled_first(list);
+        for (; walker && copied < max; walker = coupled_step(walker)) values[copied++] = walker->data;
+        if (walker) pthread_mutex_unlock(&walker->lock);
+        return copied;
+    }
+    pthread_rwlock_rdlock(&list->lock);
+    for (Node* walker = *list->head; walker && copied < max; walker = walker->next) values[copied++] = walker->data;
+    pthread_rwlock_unlock(&list->lock);
+    return copied;
+}
+
+/// @brief Replaces the contents of the list with @p n values; the new nodes
+/// are allocated in batches first, swapped in under one lock, and the old
+/// ones freed in batches afterwards
+/// @param list list
+/// @param values new values in order
+/// @param n number of values, 0 empties the list
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full, in
+/// which case the list is unchanged
+int list_assign(List* list, const uint16_t* values, size_t n) {
+    Node* last = NULL;
+    Node* chain = n ? alloc_chain(list, values, n, &last) : NULL;
+    if (n && !chain) {
+        errno = ENOMEM;
+        return -1;
+    }
+    Node* old;
+    if (list->locking == LIST_LOCK_COUPLING) {
+        pthread_mutex_lock(&list->head_lock);
+        old = *list->head;
+        *list->head = chain;
+        __atomic_store_n(&list->count, n, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&list->head_lock);
+        coupled_drain(list, old);
+        return 0;
+    }
+    pthread_rwlock_wrlock(&list->lock);
+    old = *list->head;
+    *list->head = chain;
+    list->tail = last;
+    __atomic_store_n(&list->count, n, __ATOMIC_RELAXED);
+    if (list->index) {
+        memset(list->index, 0, INDEX_ENTRIES * sizeof(index_entry));
+        index_append(list, NULL, chain);
+    }
+    pthread_rwlock_unlock(&list->lock);
+    free_chain(list, old);
+    return 0;
+}
+
+/// @brief Appends @p n values with one lock and nodes allocated in batches
 /// @param head list head
-void list_cleanup(Node** head) {
-    *head = NULL;
-    mem_deinit();
-    pthread_rwlock_destroy(&lock);
-}
\ No newline at end of file
+/// @param values values to append in order
+/// @param n number of values
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full
+int list_insert_bulk(Node** head, const uint16_t* values, size_t n) { return list_add_bulk(legacy(head), values, n); }
+
+/// @brief Deletes every node holding @p data in one pass
+/// @param head list head
+/// @param data value to delete
+/// @return number of nodes deleted
+size_t list_delete_all(Node** head, uint16_t data) { return list_remove_all(legacy(head), data); }
+
+/// @brief Copies the values in list order
+/// @param head list head
+/// @param values array receiving up to @p max values
+/// @param max capacity of @p values
+/// @return number of values copied
+size_t list_to_array(Node** head, uint16_t* values, size_t max) { return list_copy(legacy(head), values, max); }
+
+/// @brief Replaces the contents of the list with @p n values
+/// @param head list head
+/// @param values new values in order
+/// @param n number of values
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full
+int list_from_array(Node** head, const uint16_t* values, size_t n) { return list_assign(legacy(head), values, n); }
+
+/// @brief Gives the list a value index, so list_search and list_delete take
+/// constant time; see list_index. Passing another head variable later drops it.
+/// @param head list head
+/// @return 0 on success, -1 with errno set to EINVAL under LIST_LOCK_COUPLING or ENOMEM if the pool is full
+int list_build_index(Node** head) { return list_index(legacy(head)); }
+
+// Under LIST_LOCK_COUPLING a cursor holds the locks of its current node and
+// of the one before it, head_lock at the front, the same two a walk in
+// coupled_delete holds. Other threads keep working behind and ahead of it.
+
+/// @brief Locks the list for a walk and puts the cursor on the first node
+/// @param list list
+/// @param cursor cursor to set up
+/// @param write take the write lock, needed for list_cursor_insert_here and list_cursor_delete_here
+/// @return first node, NULL if the list is empty
+Node* list_cursor_begin(List* list, list_cursor* cursor, bool write) {
+    *cursor = (list_cursor){list, NULL, NULL, write};
+    if (list->locking == LIST_LOCK_COUPLING) {
+        pthread_mutex_lock(&list->head_lock);
+        cursor->node = *list->head;
+        if (cursor->node) pthread_mutex_lock(&cursor->node->lock);
+        return cursor->node;
+    }
+    if (write) pthread_rwlock_wrlock(&list->lock);
+    else pthread_rwlock_rdlock(&list->lock);
+    cursor->node = *list->head;
+    return cursor->node;
+}
+
+/// @brief Moves the cursor to the next node
+/// @param cursor cursor from list_cursor_begin
+/// @return the new current node, NULL past the end
+Node* list_cursor_next(list_cursor* cursor) {
+    Node* node = cursor->node;
+    if (!node) return NULL;
+    if (cursor->list->locking == LIST_LOCK_COUPLING) {
+        if (node->next) pthread_mutex_lock(&node->next->lock);
+        pthread_mutex_unlock(cursor->prev ? &cursor->prev->lock : &cursor->list->head_lock);
+    }
+    cursor->prev = node;
+    cursor->node = node->next;
+    return cursor->node;
+}
+
+/// @brief Inserts a node before the current one, or at the end past it; the
+/// cursor stays on the current node, behind the new one
+/// @param cursor write cursor from list_cursor_begin
+/// @param data data for the new node
+/// @return 0 on success, -1 with errno set to EPERM for a read cursor or
+/// ENOMEM if the pool is full
+int list_cursor_insert_here(list_cursor* cursor, uint16_t data) {
+    List* list = cursor->list;
+    if (!cursor->write) {
+        errno = EPERM;
+        return -1;
+    }
+    Node* new_node = alloc_node(list, data);
+    if (!new_node) {
+        errno = ENOMEM;
+        return -1;
+    }
+    new_node->next = cursor->node;
+    if (cursor->prev) cursor->prev->next = new_node;
+    else *list->head = new_node;
+    if (list->locking == LIST_LOCK_COUPLING) { // The new node takes over as the one before
+        pthread_mutex_lock(&new_node->lock);
+        pthread_mutex_unlock(cursor->prev ? &cursor->prev->lock : &list->head_lock);
+    } else {
+        if (!cursor->node) list->tail = new_node;
+        if (list->index) index_insert(list, cursor->prev, new_node);
+    }
+    cursor->prev = new_node;
+    count_add(list);
+    return 0;
+}
+
+/// @brief Deletes the current node and moves the cursor to the next one
+/// @param cursor write cursor from list_cursor_begin
+/// @return 0 on success, -1 with errno set to EPERM for a read cursor or
+/// ENOENT past the end
+int list_cursor_delete_here(list_cursor* cursor) {
+    List* list = cursor->list;
+    Node* node = cursor->node;
+    if (!cursor->write || !node) {
+        errno = cursor->write ? ENOENT : EPERM;
+        return -1;
+    }
+    if (cursor->prev) cursor->prev->next = node->next;
+    else *list->head = node->next;
+    if (list->locking == LIST_LOCK_COUPLING) {
+        if (node->next) pthread_mutex_lock(&node->next->lock);
+        pthread_mutex_unlock(&node->lock);
+    } else {
+        if (node == list->tail) list->tail = cursor->prev;
+        if (list->index) index_remove(list, cursor->prev, node);
+    }
+    cursor->node = node->next;
+    count_sub(list);
+    free_node(list, node);
+    return 0;
+}
+
+/// @brief Unlocks the list; the cursor cannot be used anymore
+/// @param cursor cursor from list_cursor_begin
+void list_cursor_end(list_cursor* cursor) {
+    List* list = cursor->list;
+    if (list->locking == LIST_LOCK_COUPLING) {
+        if (cursor->node) pthread_mutex_unlock(&cursor->node->lock);
+        pthread_mutex_unlock(cursor->prev ? &cursor->prev->lock : &list->head_lock);
+    } else {
+        pthread_rwlock_unlock(&list->lock);
+    }
+    cursor->node = cursor->prev = NULL;
+}
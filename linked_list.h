@@ -12,12 +12,57 @@
 typedef struct Node {
     uint16_t data;      // Stores the data as an unsigned 16-bit integer
     struct Node *next;  // Pointer to the next node in the list
-    pthread_mutex_t lock;
+    pthread_mutex_t lock; // Guards next while the list uses LIST_LOCK_COUPLING
 
 } Node;
 
+// How the list functions synchronize, chosen by list_init_locking
+typedef enum list_locking {
+    LIST_LOCK_GLOBAL,   // One reader-writer lock around every operation, the default; appends start at the tail
+    LIST_LOCK_COUPLING, // Hand-over-hand locking of the nodes, writers in different parts run in parallel; appends walk from the head
+} list_locking;
+
+// A list with its own locks, head and node count. Any number of them can
+// share the pool, each allocating its nodes under its own memory tag. Under
+// LIST_LOCK_GLOBAL it also keeps its last node, so list_add and list_insert
+// take constant time; under LIST_LOCK_COUPLING, and in the lock-free
+// implementation, which ignores the locking mode, they walk the whole list.
+// list_index, or list_build_index for the list behind the Node** functions,
+// makes lookups by value constant time the same way; the lock-free
+// implementation has no index and fails both with EINVAL.
+typedef struct List List;
+
+// A list of 8-byte nodes that link by 32-bit pool offsets and carry no mutex,
+// guarded by one reader-writer lock per list. Nodes are carved out of slabs,
+// so an element costs a seventh of a Node. Implemented in compact_list.c.
+typedef struct CompactList CompactList;
+
+// An unrolled list: nodes hold up to 32 values each, which a search compares
+// all at once with SSE2 or AVX2 where the CPU has them. ULIST_SEARCH set to
+// "scalar", "sse2" or "avx2" overrides the choice for lists created after it;
+// "avx2" on a CPU without AVX2 gets SSE2.
+// Implemented in unrolled_list.c.
+typedef struct UnrolledList UnrolledList;
+
+// A position in a List from list_cursor_begin to list_cursor_end, which
+// keeps the list locked in between, so a walk with edits costs one pass
+typedef struct list_cursor {
+    List *list;
+    Node *prev; // Node before the current one, NULL at the front
+    Node *node; // Current node, NULL past the end
+    int write;  // Edits allowed, the write lock is held
+} list_cursor;
+
+// How list_write lays the values out. Implemented in list_write.c.
+typedef enum list_format {
+    LIST_FORMAT_TEXT = 0,     // "[1, 2, 3]", as list_print shows it
+    LIST_FORMAT_BINARY = 1,   // Little-endian 16-bit values, nothing else
+    LIST_FORMAT_SNAPSHOT = 2, // Flag: copy the values out under the lock, format them after releasing it
+} list_format;
+
 // Function declarations
 void list_init(Node **head, size_t size);
+void list_init_locking(Node **head, size_t size, list_locking locking);
 void list_insert(Node **head, uint16_t data);
 void list_insert_after(Node *prev_node, uint16_t data);
 void list_insert_before(Node **head, Node *next_node, uint16_t data);
@@ -29,5 +74,53 @@ void list_display_range(Node **head, Node *start_node, Node *end_node);
 
 int list_count_nodes(Node **head);
 void list_cleanup(Node **head);
+int list_insert_bulk(Node **head, const uint16_t *values, size_t n);
+size_t list_delete_all(Node **head, uint16_t data);
+size_t list_to_array(Node **head, uint16_t *values, size_t max);
+int list_from_array(Node **head, const uint16_t *values, size_t n);
+int list_build_index(Node **head);
+
+List *list_create(list_locking locking, unsigned tag);
+void list_destroy(List *list);
+void list_add(List *list, uint16_t data);
+void list_add_after(List *list, Node *prev_node, uint16_t data);
+void list_add_before(List *list, Node *next_node, uint16_t data);
+void list_remove(List *list, uint16_t data);
+Node *list_find(List *list, uint16_t data);
+Node *list_first(List *list);
+size_t list_size(List *list);
+void list_print(List *list);
+void list_print_range(List *list, Node *start_node, Node *end_node);
+int list_index(List *list);
+size_t list_count_value(List *list, uint16_t data);
+int list_add_bulk(List *list, const uint16_t *values, size_t n);
+size_t list_remove_all(List *list, uint16_t data);
+size_t list_copy(List *list, uint16_t *values, size_t max);
+int list_assign(List *list, const uint16_t *values, size_t n);
+Node *list_cursor_begin(List *list, list_cursor *cursor, bool write);
+Node *list_cursor_next(list_cursor *cursor);
+int list_cursor_insert_here(list_cursor *cursor, uint16_t data);
+int list_cursor_delete_here(list_cursor *cursor);
+void list_cursor_end(list_cursor *cursor);
+int list_write(List *list, int fd, list_format format);
+
+CompactList *clist_create(unsigned tag);
+void clist_destroy(CompactList *list);
+int clist_add(CompactList *list, uint16_t data);
+int clist_remove(CompactList *list, uint16_t data);
+bool clist_contains(CompactList *list, uint16_t data);
+size_t clist_size(CompactList *list);
+size_t clist_copy(CompactList *list, uint16_t *values, size_t max);
+void clist_print(CompactList *list);
+
+UnrolledList *ulist_create(unsigned tag);
+void ulist_destroy(UnrolledList *list);
+int ulist_add(UnrolledList *list, uint16_t data);
+int ulist_remove(UnrolledList *list, uint16_t data);
+bool ulist_contains(UnrolledList *list, uint16_t data);
+size_t ulist_size(UnrolledList *list);
+size_t ulist_copy(UnrolledList *list, uint16_t *values, size_t max);
+void ulist_print(UnrolledList *list);
+const char *ulist_search_kind(UnrolledList *list);
 
 #endif  // LINKED_LIST_H
\ No newline at end of file
@@ -0,0 +1,107 @@
+// list_write.c
+// Writes a List to a file descriptor through a fixed buffer, for either
+// implementation of linked_list.h
+#include "linked_list.h"
+#include <errno.h>
+#include <unistd.h>
+
+#define LIST_WRITE_BUFFER 4096 // Bytes formatted before each write(2)
+#define LIST_WRITE_MAX_ITEM 8  // Longest formatted value: ", 65535"
+
+// Values are formatted into one stack buffer that is handed to write(2)
+// whenever it fills, so a dump makes a call per few thousand bytes instead of
+// stdio calls per value, and allocates nothing. Without LIST_FORMAT_SNAPSHOT
+// that happens during one read cursor walk, with the list's lock held; with
+// it the values are copied out first and the lock is free while they are
+// formatted and written.
+
+typedef struct list_writer {
+    int fd;
+    list_format format;
+    size_t used;
+    size_t values; // Values formatted so far
+    char buffer[LIST_WRITE_BUFFER];
+} list_writer;
+
+// Hands the buffer to write(2) until it all went out
+static int flush(list_writer *writer) {
+    for (size_t done = 0; done < writer->used;) {
+        ssize_t written = write(writer->fd, writer->buffer + done, writer->used - done);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += written;
+    }
+    writer->used = 0;
+    return 0;
+}
+
+static int put(list_writer *writer, uint16_t data) {
+    if (writer->used + LIST_WRITE_MAX_ITEM > LIST_WRITE_BUFFER && flush(writer) != 0) return -1;
+    char *out = writer->buffer + writer->used;
+    if (writer->format & LIST_FORMAT_BINARY) {
+        out[0] = data & 0xff; // Little-endian whatever the host
+        out[1] = data >> 8;
+        writer->used += 2;
+    } else {
+        if (writer->values) {
+            *out++ = ',';
+            *out++ = ' ';
+        }
+        char digits[5];
+        int n = 0;
+        do digits[n++] = '0' + data % 10;
+        while (data /= 10);
+        while (n) *out++ = digits[--n];
+        writer->used = out - writer->buffer;
+    }
+    writer->values++;
+    return 0;
+}
+
+static int put_char(list_writer *writer, char c) {
+    if (writer->format & LIST_FORMAT_BINARY) return 0;
+    if (writer->used == LIST_WRITE_BUFFER && flush(writer) != 0) return -1;
+    writer->buffer[writer->used++] = c;
+    return 0;
+}
+
+/// @brief Writes the values of @p list to @p fd: as text the way list_print
+/// shows them, or in binary as little-endian 16-bit values one after the other
+/// @param list list
+/// @param fd file descriptor open for writing
+/// @param format LIST_FORMAT_TEXT or LIST_FORMAT_BINARY, with LIST_FORMAT_SNAPSHOT
+/// to copy the values out under the lock and write them after releasing it
+/// @return 0 on success, -1 with errno set by write(2), or to ENOMEM if a
+/// snapshot does not fit in the pool
+int list_write(List *list, int fd, list_format format) {
+    list_writer writer = {.fd = fd, .format = format};
+    int result = put_char(&writer, '[');
+    if (format & LIST_FORMAT_SNAPSHOT) {
+        size_t max = list_size(list) + 1; // One more tells whether the list grew meanwhile
+        uint16_t *values = NULL;
+        size_t count;
+        for (;;) {
+            values = mem_alloc(max * sizeof(uint16_t));
+            if (!values) {
+                errno = ENOMEM;
+                return -1;
+            }
+            count = list_copy(list, values, max);
+            if (count < max) break;
+            mem_free(values);
+            max *= 2;
+        }
+        for (size_t i = 0; i < count && result == 0; i++) result = put(&writer, values[i]);
+        mem_free(values);
+    } else {
+        list_cursor cursor;
+        for (Node *node = list_cursor_begin(list, &cursor, false); node && result == 0; node = list_cursor_next(&cursor))
+            result = put(&writer, node->data);
+        list_cursor_end(&cursor);
+    }
+    if (result == 0) result = put_char(&writer, ']');
+    if (result == 0) result = flush(&writer);
+    return result;
+}
@@ -0,0 +1,800 @@
+// lockfree_list.c
+// Lock-free implementation of linked_list.h: nodes are linked with
+// compare-and-swap and deleted in two steps, first logically by marking their
+// next pointer, then physically by unlinking them (Harris, Michael)
+#define _GNU_SOURCE
+#include "linked_list.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#define LF_MARK ((uintptr_t)1)  // Low bit of next: the node owning it is deleted
+#define LF_MAX_THREADS 1024     // Threads that can use the list at the same time
+#define LF_RETIRE_BATCH 32      // Nodes a thread retires before it tries to advance the epoch
+#define LF_BATCH 256            // Nodes the bulk operations allocate per call into the memory manager
+
+// Nodes are unlinked while other threads may still be walking over them, so
+// they are freed by epochs: every operation publishes the global epoch it
+// started in and the epoch only advances once every thread inside an
+// operation has seen the current one. A walker that can still hold a node
+// unlinked in epoch e started in e or earlier, so once the epoch reaches e + 2
+// the node goes back to mem_free. Retired nodes wait in one of three bags per
+// thread, chained through the storage of their mutex, which this list never
+// uses. An allocation that finds the pool full pushes the epoch on until this
+// thread's own bags are empty, waiting for threads that hold the epoch back
+// instead of counting attempts, and fails only if the pool is still full then.
+// Whether it fails so depends on the live nodes and on this thread's retired
+// ones, not on scheduling; nodes other threads retired go back when those
+// threads start their next operation.
+
+// Lists from list_create; the epochs and bags are shared by all of them
+struct List {
+    Node *first;
+    size_t count; // Live nodes, updated atomically by the operation that links or marks one
+    unsigned tag; // Memory tag the nodes are allocated under
+};
+
+typedef struct lf_thread {
+    unsigned long epoch; // Global epoch at the start of the current operation
+    int active;          // Inside an operation
+    int in_use;          // Claimed by a running thread
+    Node *bags[3];       // Retired nodes by the global epoch they were unlinked in, % 3
+    int retired;         // Nodes retired since the last attempt to advance the epoch
+} __attribute__((aligned(64))) lf_thread;
+
+_Static_assert(sizeof(((Node *)0)->lock) >= sizeof(Node *), "a retired node chains through its lock");
+
+static lf_thread threads_[LF_MAX_THREADS];
+static int lists_;         // Lists from list_create not destroyed yet
+static int legacy_active_; // Between list_init and list_cleanup
+static int thread_count_; // Slots ever claimed, the rest need no scanning
+static unsigned long epoch_;
+static __thread lf_thread *self_;
+static pthread_key_t exit_key_;
+static pthread_once_t key_once_ = PTHREAD_ONCE_INIT;
+
+static Node *unmarked(Node *ptr) { return (Node *)((uintptr_t)ptr & ~LF_MARK); }
+static int is_marked(Node *ptr) { return ((uintptr_t)ptr & LF_MARK) != 0; }
+static Node **bag_link(Node *node) { return (Node **)&node->lock; }
+
+static Node *load(Node **link) { return __atomic_load_n(link, __ATOMIC_ACQUIRE); }
+
+static int cas(Node **link, Node *expected, Node *desired) {
+    return __atomic_compare_exchange_n(link, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Thread exit: the slot goes back with its bags, whoever claims it next frees them
+static void thread_exit(void *arg) {
+    lf_thread *thread = arg;
+    __atomic_store_n(&thread->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_key() { pthread_key_create(&exit_key_, thread_exit); }
+
+static lf_thread *self() {
+    if (self_) return self_;
+    pthread_once(&key_once_, create_key);
+    for (int i = 0; i < LF_MAX_THREADS; i++) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&threads_[i].in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            int count = __atomic_load_n(&thread_count_, __ATOMIC_RELAXED);
+            while (count <= i && !__atomic_compare_exchange_n(&thread_count_, &count, i + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+            self_ = &threads_[i];
+            pthread_setspecific(exit_key_, self_);
+            return self_;
+        }
+    }
+    fprintf(stderr, "lockfree_list: more than %d threads\n", LF_MAX_THREADS);
+    exit(EXIT_FAILURE);
+}
+
+static void free_bag(Node **bag) {
+    Node *node = *bag;
+    while (node) {
+        Node *next = *bag_link(node);
+        mem_free(node);
+        node = next;
+    }
+    *bag = NULL;
+}
+
+// Starts an operation: no node this thread can reach is freed until op_exit
+static lf_thread *op_enter() {
+    lf_thread *thread = self();
+    __atomic_store_n(&thread->active, 1, __ATOMIC_RELAXED);
+    atomic_thread_fence(memory_order_seq_cst); // Publish active before reading the epoch
+    unsigned long epoch = __atomic_load_n(&epoch_, __ATOMIC_ACQUIRE);
+    if (epoch != thread->epoch) {
+        // This bag holds nodes of epoch - 2 or earlier
+        __atomic_store_n(&thread->epoch, epoch, __ATOMIC_RELEASE);
+        free_bag(&thread->bags[(epoch + 1) % 3]);
+    }
+    return thread;
+}
+
+static void op_exit(lf_thread *thread) {
+    __atomic_store_n(&thread->active, 0, __ATOMIC_RELEASE);
+}
+
+// Moves the epoch on if every thread inside an operation has seen the current one
+static void try_advance() {
+    unsigned long epoch = __atomic_load_n(&epoch_, __ATOMIC_ACQUIRE);
+    int count = __atomic_load_n(&thread_count_, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < count; i++) {
+        lf_thread *thread = &threads_[i];
+        if (__atomic_load_n(&thread->active, __ATOMIC_ACQUIRE) && __atomic_load_n(&thread->epoch, __ATOMIC_ACQUIRE) != epoch)
+            return;
+    }
+    __atomic_compare_exchange_n(&epoch_, &epoch, epoch + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+// Hands a node unlinked by this thread to the epoch reclamation
+static void retire(lf_thread *thread, Node *node) {
+    Node **bag = &thread->bags[__atomic_load_n(&epoch_, __ATOMIC_ACQUIRE) % 3];
+    *bag_link(node) = *bag;
+    *bag = node;
+    if (++thread->retired >= LF_RETIRE_BATCH) {
+        thread->retired = 0;
+        try_advance();
+    }
+}
+
+// Walks from @p head, unlinking the deleted nodes it passes. With @p match set
+// it stops at the first live node holding @p data and returns it, with *link
+// pointing to the field that links it in; otherwise it walks the whole list.
+static Node *find(lf_thread *thread, Node **head, int match, uint16_t data, Node ***link) {
+retry:;
+    Node **prev = head;
+    Node *cur = load(prev);
+    while (cur) {
+        Node *next = load(&cur->next);
+        if (is_marked(next)) {
+            if (!cas(prev, cur, unmarked(next))) goto retry; // prev changed or was deleted itself
+            retire(thread, cur);
+            cur = unmarked(next);
+            continue;
+        }
+        if (match && cur->data == data) {
+            *link = prev;
+            return cur;
+        }
+        if (load(prev) != cur) goto retry;
+        prev = &cur->next;
+        cur = next;
+    }
+    if (link) *link = prev;
+    return NULL;
+}
+
+static int bags_empty(lf_thread *thread) { return !thread->bags[0] && !thread->bags[1] && !thread->bags[2]; }
+
+// Allocates a node outside of an operation
+static Node *new_node(uint16_t data, unsigned tag) {
+    Node *node = mem_alloc_tagged(sizeof(Node), tag);
+    lf_thread *thread = self();
+    // Pool full: every second advance lets this thread free another of its bags
+    while (!node && !bags_empty(thread)) {
+        try_advance();
+        op_exit(op_enter());
+        node = mem_alloc_tagged(sizeof(Node), tag);
+        if (!node) sched_yield(); // Let threads holding the epoch back finish
+    }
+    if (!node) return NULL;
+    node->data = data;
+    node->next = NULL;
+    return node;
+}
+
+// Allocates nodes for @p values in batches, linked in order; NULL if the pool is full
+static Node *new_chain(const uint16_t *values, size_t n, unsigned tag) {
+    void *batch[LF_BATCH];
+    Node *first = NULL, *prev = NULL;
+    for (size_t done = 0; done < n;) {
+        size_t take = n - done < LF_BATCH ? n - done : LF_BATCH;
+        if (mem_alloc_batch(sizeof(Node), take, batch, tag) != 0) {
+            while (first) { // Nobody else has seen these
+                Node *next = first->next;
+                mem_free(first);
+                first = next;
+            }
+            return NULL;
+        }
+        for (size_t i = 0; i < take; i++) {
+            Node *node = batch[i];
+            node->data = values[done + i];
+            node->next = NULL;
+            if (prev) prev->next = node;
+            else first = node;
+            prev = node;
+        }
+        done += take;
+    }
+    return first;
+}
+
+/// @brief Initializes the list
+/// @param head list head
+void list_init(Node **head, size_t size) {
+    mem_init(size);
+    *head = NULL;
+    legacy_active_ = 1;
+    // Bags left over from an earlier pool refer to memory that is gone
+    for (int i = 0; i < LF_MAX_THREADS; i++) threads_[i].bags[0] = threads_[i].bags[1] = threads_[i].bags[2] = NULL;
+}
+
+/// @brief Initializes the list; the lock-free list takes no locks, @p locking is ignored
+/// @param head list head
+void list_init_locking(Node **head, size_t size, list_locking locking) {
+    (void)locking;
+    list_init(head, size);
+}
+
+// Links @p node in behind the last node, inside an operation
+static void append(lf_thread *thread, Node **head, Node *node) {
+    Node **link = head;
+    for (;;) {
+        Node *next = load(link);
+        while (unmarked(next)) { // Follow the links to the end, deleted nodes included
+            link = &unmarked(next)->next;
+            next = load(link);
+        }
+        if (next == NULL && cas(link, NULL, node)) break;
+        if (is_marked(next)) { // The last node is deleted, unlink it and start over
+            find(thread, head, 0, 0, NULL);
+            link = head;
+        }
+    }
+}
+
+// Links @p node in behind the last node
+static void insert(Node **head, Node *node) {
+    lf_thread *thread = op_enter();
+    append(thread, head, node);
+    op_exit(thread);
+}
+
+// Links @p node in after @p prev_node; frees it and returns -1 if prev_node is deleted
+static int insert_after(Node *prev_node, Node *node) {
+    int result = 0;
+    lf_thread *thread = op_enter();
+    for (;;) {
+        Node *next = load(&prev_node->next);
+        if (is_marked(next)) {
+            mem_free(node);
+            result = -1;
+            break;
+        }
+        node->next = next;
+        if (cas(&prev_node->next, next, node)) break;
+    }
+    op_exit(thread);
+    return result;
+}
+
+// Links @p node in before @p next_node, inside an operation; frees it and
+// returns -1 if next_node is not in the list
+static int link_before(lf_thread *thread, Node **head, Node *next_node, Node *node) {
+    int result = 0;
+    node->next = next_node;
+    for (;;) {
+        Node **link = head;
+        Node *next = load(link);
+        while (unmarked(next) && unmarked(next) != next_node) {
+            link = &unmarked(next)->next;
+            next = load(link);
+        }
+        if (!unmarked(next)) { // next_node is not in the list
+            mem_free(node);
+            result = -1;
+            break;
+        }
+        if (!is_marked(next) && cas(link, next_node, node)) break;
+        if (is_marked(next)) find(thread, head, 0, 0, NULL); // The node before it is deleted
+    }
+    return result;
+}
+
+// Links @p node in before @p next_node; frees it and returns -1 if next_node is not in the list
+static int insert_before(Node **head, Node *next_node, Node *node) {
+    lf_thread *thread = op_enter();
+    int result = link_before(thread, head, next_node, node);
+    op_exit(thread);
+    return result;
+}
+
+// Deletes the first live node holding @p data; returns -1 if there is none
+static int delete(Node **head, uint16_t data) {
+    int result = -1;
+    lf_thread *thread = op_enter();
+    for (;;) {
+        Node **link;
+        Node *node = find(thread, head, 1, data, &link);
+        if (!node) break;
+        Node *next = load(&node->next);
+        if (is_marked(next) || !cas(&node->next, next, (Node *)((uintptr_t)next | LF_MARK))) continue;
+        // Deleted; unlink it here or leave that to the next walk over it
+        if (cas(link, node, next)) retire(thread, node);
+        else find(thread, head, 0, 0, NULL);
+        result = 0;
+        break;
+    }
+    op_exit(thread);
+    return result;
+}
+
+/// @brief inserts last in linked list
+/// @param head list head
+/// @param data data for the new node
+void list_insert(Node **head, uint16_t data) {
+    Node *node = new_node(data, 0);
+    if (node) insert(head, node);
+}
+
+/// @brief Inserts a node after prev_node, unless prev_node has been deleted
+/// @param prev_nodenode that will be before new node
+/// @param data data for the new node
+void list_insert_after(Node *prev_node, uint16_t data) {
+    if (prev_node == NULL) return;
+    Node *node = new_node(data, 0);
+    if (node) insert_after(prev_node, node);
+}
+
+/// @brief inserts before a node
+/// @param head list head
+/// @param next_node node that will be after new node
+/// @param data data for the new node
+void list_insert_before(Node **head, Node *next_node, uint16_t data) {
+    Node *node = new_node(data, 0);
+    if (node) insert_before(head, next_node, node);
+}
+
+/// @brief deletes the first live Node with data
+/// @param head list head
+/// @param data
+void list_delete(Node **head, uint16_t data) { delete(head, data); }
+
+// Marks every live node holding @p data in one walk, then unlinks them in another
+static size_t delete_all(Node **head, uint16_t data) {
+    size_t count = 0;
+    lf_thread *thread = op_enter();
+    for (Node *walker = load(head); walker;) {
+        Node *next = load(&walker->next);
+        while (!is_marked(next) && walker->data == data) {
+            if (cas(&walker->next, next, (Node *)((uintptr_t)next | LF_MARK))) {
+                count++;
+                break;
+            }
+            next = load(&walker->next); // A node got linked in behind it, try again
+        }
+        walker = unmarked(next);
+    }
+    if (count) find(thread, head, 0, 0, NULL);
+    op_exit(thread);
+    return count;
+}
+
+// Copies the values of the live nodes in list order
+static size_t to_array(Node **head, uint16_t *values, size_t max) {
+    size_t copied = 0;
+    lf_thread *thread = op_enter();
+    for (Node *walker = load(head); walker && copied < max;) {
+        Node *next = load(&walker->next);
+        if (!is_marked(next)) values[copied++] = walker->data;
+        walker = unmarked(next);
+    }
+    op_exit(thread);
+    return copied;
+}
+
+// Deletes every live node, then appends @p chain; operations running meanwhile may land on either side
+static size_t replace(Node **head, Node *chain) {
+    size_t count = 0;
+    lf_thread *thread = op_enter();
+    for (Node *walker = load(head); walker;) {
+        Node *next = load(&walker->next);
+        if (is_marked(next)) {
+            walker = unmarked(next);
+        } else if (cas(&walker->next, next, (Node *)((uintptr_t)next | LF_MARK))) {
+            count++;
+            walker = next;
+        }
+    }
+    find(thread, head, 0, 0, NULL);
+    op_exit(thread);
+    if (chain) insert(head, chain);
+    return count;
+}
+
+/// @brief Appends @p n values, allocated in batches and linked in with one compare-and-swap
+/// @param head list head
+/// @param values values to append in order
+/// @param n number of values
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full
+int list_insert_bulk(Node **head, const uint16_t *values, size_t n) {
+    if (n == 0) return 0;
+    Node *chain = new_chain(values, n, 0);
+    if (!chain) {
+        errno = ENOMEM;
+        return -1;
+    }
+    insert(head, chain);
+    return 0;
+}
+
+/// @brief Deletes every live node holding @p data in one pass
+/// @param head list head
+/// @param data value to delete
+/// @return number of nodes deleted
+size_t list_delete_all(Node **head, uint16_t data) { return delete_all(head, data); }
+
+/// @brief Copies the values of the live nodes in list order
+/// @param head list head
+/// @param values array receiving up to @p max values
+/// @param max capacity of @p values
+/// @return number of values copied
+size_t list_to_array(Node **head, uint16_t *values, size_t max) { return to_array(head, values, max); }
+
+/// @brief Replaces the live nodes with @p n values
+/// @param head list head
+/// @param values new values in order
+/// @param n number of values
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full
+int list_from_array(Node **head, const uint16_t *values, size_t n) {
+    Node *chain = n ? new_chain(values, n, 0) : NULL;
+    if (n && !chain) {
+        errno = ENOMEM;
+        return -1;
+    }
+    replace(head, chain);
+    return 0;
+}
+
+/// @brief The value index needs LIST_LOCK_GLOBAL, which the lock-free list does not have
+/// @param head list head
+/// @return -1 with errno set to EINVAL
+int list_build_index(Node **head) {
+    (void)head;
+    errno = EINVAL;
+    return -1;
+}
+
+/// @brief return the pointer to the first live node with data or NULL if not found
+/// @param head list head
+/// @param data value to search for
+/// @return Node* or NULL if node not found
+Node *list_search(Node **head, uint16_t data) {
+    lf_thread *thread = op_enter();
+    Node *walker = load(head);
+    while (walker) {
+        Node *next = load(&walker->next);
+        if (!is_marked(next) && walker->data == data) break;
+        walker = unmarked(next);
+    }
+    op_exit(thread);
+    return walker;
+}
+
+/// @brief displays all nodes
+/// @param head list head
+void list_display(Node **head) { list_display_range(head, NULL, NULL); }
+
+/// @brief Displays the live nodes in the range, including start and end
+/// @param head list head
+/// @param start_node first node to display
+/// @param end_node last node to display
+void list_display_range(Node **head, Node *start_node, Node *end_node) {
+    lf_thread *thread = op_enter();
+    Node *walker = start_node ? start_node : load(head);
+    int first = 1;
+    printf("[");
+    while (walker) {
+        Node *next = load(&walker->next);
+        if (!is_marked(next)) {
+            printf(first ? "%d" : ", %d", walker->data);
+            first = 0;
+        }
+        if (walker == end_node) break;
+        walker = unmarked(next);
+    }
+    printf("]");
+    op_exit(thread);
+}
+
+/// @brief returns the number of live nodes
+/// @param head list head
+/// @return int
+int list_count_nodes(Node **head) {
+    lf_thread *thread = op_enter();
+    int counter = 0;
+    for (Node *walker = load(head); walker;) {
+        Node *next = load(&walker->next);
+        counter += !is_marked(next);
+        walker = unmarked(next);
+    }
+    op_exit(thread);
+    return counter;
+}
+
+/// @brief frees all used memory, no other thread may use the list anymore
+/// @param head list head
+void list_cleanup(Node **head) {
+    *head = NULL;
+    legacy_active_ = 0;
+    mem_deinit();
+    for (int i = 0; i < LF_MAX_THREADS; i++) threads_[i].bags[0] = threads_[i].bags[1] = threads_[i].bags[2] = NULL;
+}
+
+/// @brief Creates an empty list in the pool, which mem_init or one of its
+/// variants must have set up; @p locking is ignored
+/// @param locking ignored
+/// @param tag memory tag for the list and its nodes
+/// @return the list, NULL with errno set if the pool is full or @p tag is out of range
+List *list_create(list_locking locking, unsigned tag) {
+    (void)locking;
+    if (tag >= MEM_TAG_COUNT) {
+        errno = EINVAL;
+        return NULL;
+    }
+    List *list = mem_alloc_tagged(sizeof(List), tag);
+    if (!list) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *list = (List){NULL, 0, tag};
+    __atomic_fetch_add(&lists_, 1, __ATOMIC_RELAXED);
+    return list;
+}
+
+/// @brief Frees the nodes still linked in and the list itself, no other thread
+/// may use it anymore. Deleted nodes go back through the epochs as usual,
+/// except after the last list is gone: then no operation can be running, and
+/// every bag is emptied so that mem_deinit can follow.
+/// @param list list from list_create
+void list_destroy(List *list) {
+    for (Node *walker = list->first; walker;) {
+        Node *next = unmarked(walker->next);
+        mem_free(walker);
+        walker = next;
+    }
+    mem_free(list);
+    if (__atomic_sub_fetch(&lists_, 1, __ATOMIC_ACQ_REL) == 0 && !legacy_active_) {
+        int count = __atomic_load_n(&thread_count_, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < count; i++)
+            for (int bag = 0; bag < 3; bag++) free_bag(&threads_[i].bags[bag]);
+    }
+}
+
+/// @brief Appends a node after a walk from the head, there is no tail to start at
+/// @param list list
+/// @param data data for the new node
+void list_add(List *list, uint16_t data) {
+    Node *node = new_node(data, list->tag);
+    if (!node) return;
+    insert(&list->first, node);
+    __atomic_fetch_add(&list->count, 1, __ATOMIC_RELAXED);
+}
+
+/// @brief Inserts a node after prev_node, unless prev_node has been deleted
+/// @param list list holding prev_node
+/// @param prev_node node that will be before new node
+/// @param data data for the new node
+void list_add_after(List *list, Node *prev_node, uint16_t data) {
+    if (prev_node == NULL) return;
+    Node *node = new_node(data, list->tag);
+    if (node && insert_after(prev_node, node) == 0) __atomic_fetch_add(&list->count, 1, __ATOMIC_RELAXED);
+}
+
+/// @brief Inserts a node before next_node, nothing if next_node is not in the list
+/// @param list list
+/// @param next_node node that will be after new node
+/// @param data data for the new node
+void list_add_before(List *list, Node *next_node, uint16_t data) {
+    Node *node = new_node(data, list->tag);
+    if (node && insert_before(&list->first, next_node, node) == 0) __atomic_fetch_add(&list->count, 1, __ATOMIC_RELAXED);
+}
+
+/// @brief deletes the first live Node with data
+/// @param list list
+/// @param data value to delete
+void list_remove(List *list, uint16_t data) {
+    if (delete(&list->first, data) == 0) __atomic_fetch_sub(&list->count, 1, __ATOMIC_RELAXED);
+}
+
+/// @brief return the pointer to the first live node with data or NULL if not found
+/// @param list list
+/// @param data value to search for
+/// @return Node* or NULL if node not found
+Node *list_find(List *list, uint16_t data) { return list_search(&list->first, data); }
+
+/// @brief returns the first node, live or not yet unlinked, to walk the list while no other thread changes it
+/// @param list list
+/// @return Node* or NULL if the list is empty
+Node *list_first(List *list) { return load(&list->first); }
+
+/// @brief returns the number of live nodes, kept up to date by every operation instead of counted
+/// @param list list
+/// @return size_t
+size_t list_size(List *list) { return __atomic_load_n(&list->count, __ATOMIC_RELAXED); }
+
+/// @brief displays all live nodes
+/// @param list list
+void list_print(List *list) { list_display_range(&list->first, NULL, NULL); }
+
+/// @brief Displays the live nodes in the range, including start and end
+/// @param list list
+/// @param start_node first node to display
+/// @param end_node last node to display
+void list_print_range(List *list, Node *start_node, Node *end_node) { list_display_range(&list->first, start_node, end_node); }
+
+/// @brief Counts the live nodes holding @p data
+/// @param list list
+/// @param data value to count
+/// @return number of nodes holding it
+size_t list_count_value(List *list, uint16_t data) {
+    lf_thread *thread = op_enter();
+    size_t counter = 0;
+    for (Node *walker = load(&list->first); walker;) {
+        Node *next = load(&walker->next);
+        counter += !is_marked(next) && walker->data == data;
+        walker = unmarked(next);
+    }
+    op_exit(thread);
+    return counter;
+}
+
+/// @brief The value index needs LIST_LOCK_GLOBAL, which the lock-free list does not have
+/// @param list list
+/// @return -1 with errno set to EINVAL
+int list_index(List *list) {
+    (void)list;
+    errno = EINVAL;
+    return -1;
+}
+
+/// @brief Appends @p n values, allocated in batches and linked in with one compare-and-swap
+/// @param list list
+/// @param values values to append in order
+/// @param n number of values
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full
+int list_add_bulk(List *list, const uint16_t *values, size_t n) {
+    if (n == 0) return 0;
+    Node *chain = new_chain(values, n, list->tag);
+    if (!chain) {
+        errno = ENOMEM;
+        return -1;
+    }
+    insert(&list->first, chain);
+    __atomic_fetch_add(&list->count, n, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/// @brief Removes every live node holding @p data in one pass
+/// @param list list
+/// @param data value to remove
+/// @return number of nodes removed
+size_t list_remove_all(List *list, uint16_t data) {
+    size_t count = delete_all(&list->first, data);
+    __atomic_fetch_sub(&list->count, count, __ATOMIC_RELAXED);
+    return count;
+}
+
+/// @brief Copies the values of the live nodes in list order
+/// @param list list
+/// @param values array receiving up to @p max values
+/// @param max capacity of @p values
+/// @return number of values copied
+size_t list_copy(List *list, uint16_t *values, size_t max) { return to_array(&list->first, values, max); }
+
+/// @brief Replaces the live nodes with @p n values
+/// @param list list
+/// @param values new values in order
+/// @param n number of values
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full
+int list_assign(List *list, const uint16_t *values, size_t n) {
+    Node *chain = n ? new_chain(values, n, list->tag) : NULL;
+    if (n && !chain) {
+        errno = ENOMEM;
+        return -1;
+    }
+    size_t removed = replace(&list->first, chain);
+    __atomic_fetch_add(&list->count, n - removed, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// A cursor stays inside one operation from list_cursor_begin to
+// list_cursor_end, so no node it can reach is freed meanwhile. It takes no
+// lock: its edits are compare-and-swaps on the link it came through, and
+// when another thread changed that link first, they fall back to a search
+// from the head.
+
+// First live node from @p node on
+static Node *live_from(Node *node) {
+    while (node && is_marked(load(&node->next))) node = unmarked(load(&node->next));
+    return node;
+}
+
+/// @brief Starts a walk and puts the cursor on the first live node
+/// @param list list
+/// @param cursor cursor to set up
+/// @param write allow list_cursor_insert_here and list_cursor_delete_here
+/// @return first live node, NULL if there is none
+Node *list_cursor_begin(List *list, list_cursor *cursor, bool write) {
+    *cursor = (list_cursor){list, NULL, NULL, write};
+    op_enter();
+    cursor->node = live_from(load(&list->first));
+    return cursor->node;
+}
+
+/// @brief Moves the cursor to the next live node
+/// @param cursor cursor from list_cursor_begin
+/// @return the new current node, NULL past the end
+Node *list_cursor_next(list_cursor *cursor) {
+    if (!cursor->node) return NULL;
+    cursor->prev = cursor->node;
+    cursor->node = live_from(unmarked(load(&cursor->node->next)));
+    return cursor->node;
+}
+
+/// @brief Inserts a node before the current one, or at the end past it; the
+/// cursor stays on the current node, behind the new one
+/// @param cursor write cursor from list_cursor_begin
+/// @param data data for the new node
+/// @return 0 on success, -1 with errno set to EPERM for a read cursor, ENOMEM
+/// if the pool is full or ENOENT if another thread deleted the current node
+int list_cursor_insert_here(list_cursor *cursor, uint16_t data) {
+    List *list = cursor->list;
+    if (!cursor->write) {
+        errno = EPERM;
+        return -1;
+    }
+    Node *node = mem_alloc_tagged(sizeof(Node), list->tag); // new_node would leave the operation to wait
+    if (!node) {
+        errno = ENOMEM;
+        return -1;
+    }
+    node->data = data;
+    node->next = cursor->node;
+    Node **link = cursor->prev ? &cursor->prev->next : &list->first;
+    if (!cas(link, cursor->node, node)) {
+        if (cursor->node && link_before(self(), &list->first, cursor->node, node) != 0) {
+            errno = ENOENT;
+            return -1;
+        }
+        if (!cursor->node) append(self(), &list->first, node);
+    }
+    cursor->prev = node;
+    __atomic_fetch_add(&list->count, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/// @brief Deletes the current node and moves the cursor to the next live one
+/// @param cursor write cursor from list_cursor_begin
+/// @return 0 on success, -1 with errno set to EPERM for a read cursor or
+/// ENOENT past the end or if another thread deleted the node first
+int list_cursor_delete_here(list_cursor *cursor) {
+    List *list = cursor->list;
+    Node *node = cursor->node;
+    if (!cursor->write || !node) {
+        errno = cursor->write ? ENOENT : EPERM;
+        return -1;
+    }
+    Node *next = load(&node->next);
+    while (!is_marked(next) && !cas(&node->next, next, (Node *)((uintptr_t)next | LF_MARK))) next = load(&node->next);
+    cursor->node = live_from(unmarked(next));
+    if (is_marked(next)) {
+        errno = ENOENT;
+        return -1;
+    }
+    Node **link = cursor->prev ? &cursor->prev->next : &list->first;
+    if (cas(link, node, next)) retire(self(), node);
+    else find(self(), &list->first, 0, 0, NULL);
+    __atomic_fetch_sub(&list->count, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/// @brief Ends the walk; the cursor cannot be used anymore
+/// @param cursor cursor from list_cursor_begin
+void list_cursor_end(list_cursor *cursor) {
+    op_exit(self());
+    cursor->node = cursor->prev = NULL;
+}
@@ -1,127 +1,678 @@
 #define _GNU_SOURCE
 #include "memory_manager.h"
+#include "mm_internal.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-// Struct representing a block of memory
-typedef struct memory_block {
-    void *start;             // Start address of the memory block
-    void *end;               // End address of the memory block
-    struct memory_block *next; // Pointer to the next memory block in the linked list
-} memory_block;
+#define MM_ATTACH_TIMEOUT_MS 5000 // How long mem_init_shared waits for the creator to publish the pool
 
-// Factory function for creating a new memory block
-memory_block *memory_block_factory(void *start, void *end, memory_block *next) {
-    // Allocate space for a new memory_block structure
-    memory_block *new_block = malloc(sizeof(*new_block));
-    if (!new_block) return NULL; // Return NULL if allocation fails
+// Factory function for creating a new memory block, returns its index or MM_NIL
+static uint32_t memory_block_factory(size_t start, size_t end, uint32_t next, unsigned tag);
 
-    // Initialize block's properties
-    new_block->start = start;
-    new_block->end = end;
-    new_block->next = next;
-    return new_block;
+// Mutex for managing concurrent access to the memory manager, lives in the pool header
+pthread_mutex_t *allocation_lock;
+
+mm_header *header_;    // Header at the start of the mapping
+memory_block *nodes_;  // Node table holding the block list
+char *memory_;         // Pointer to the start of the managed memory
+size_t size_;          // Total size of the managed memory
+size_t map_size_;      // Length of the whole mapping
+int pool_fd_ = -1;     // Backing file of the pool, -1 for anonymous pools
+mm_pool_mode pool_mode_; // Kind of mapping the pool lives in
+
+size_t page_round(size_t n) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (n + page - 1) / page * page;
+}
+
+// Checksum over the parts of the header that never change after creation
+static uint64_t geometry_checksum(const mm_header *hdr) {
+    uint64_t fields[] = {hdr->magic, hdr->version, hdr->pool_size, hdr->pool_offset, hdr->node_offset, hdr->node_reserve, hdr->backend};
+    uint64_t hash = 0xcbf29ce484222325ULL; // FNV-1a
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        hash ^= fields[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Fills in the geometry of a fresh pool of @p size bytes
+static void header_layout(mm_header *hdr, size_t size, mem_backend backend) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = MM_MAGIC;
+    hdr->version = MM_VERSION;
+    hdr->pool_size = size;
+    hdr->backend = backend;
+    hdr->pool_offset = page_round(backend == MEM_BACKEND_TLSF ? tlsf_metadata_end() : sizeof(mm_header));
+    hdr->node_offset = hdr->pool_offset + page_round(size ? size : 1);
+    // Every block holds at least one byte, so the pool can never need more nodes than bytes.
+    // TLSF keeps its block headers in the pool and needs no node table.
+    if (backend == MEM_BACKEND_TLSF) hdr->node_reserve = 0;
+    else hdr->node_reserve = size < MM_NIL ? (size ? size : 1) : MM_NIL;
+    hdr->geometry_sum = geometry_checksum(hdr);
+    hdr->node_commit = hdr->node_reserve < MM_INITIAL_NODES ? hdr->node_reserve : MM_INITIAL_NODES;
+    hdr->node_used = 0;
+    hdr->head = MM_NIL;
+    hdr->free_nodes = MM_NIL;
+    hdr->root = MM_NO_ROOT;
+}
+
+size_t committed_size(const mm_header *hdr, uint64_t node_commit) {
+    return page_round(hdr->node_offset + node_commit * sizeof(memory_block));
+}
+
+// Checks a header read from a pool file before any of it is trusted for the mapping
+static int header_valid(const mm_header *hdr, size_t size, off_t file_size) {
+    return hdr->magic == MM_MAGIC && hdr->version == MM_VERSION && hdr->geometry_sum == geometry_checksum(hdr) &&
+           hdr->backend <= MEM_BACKEND_SORTED &&
+           (!size || size == hdr->pool_size) && hdr->node_commit <= hdr->node_reserve &&
+           hdr->node_used <= hdr->node_commit && (uint64_t)file_size >= committed_size(hdr, hdr->node_commit);
+}
+
+// Points the globals at a mapping whose header is valid. The lock is set up
+// unless another process already did so for a shared pool.
+static void attach_mapping(char *base, size_t map_size, int fd, mm_pool_mode mode, int init_lock) {
+    header_ = (mm_header *)base;
+    memory_ = base + header_->pool_offset;
+    nodes_ = (memory_block *)(base + header_->node_offset);
+    size_ = header_->pool_size;
+    map_size_ = map_size;
+    pool_fd_ = fd;
+    pool_mode_ = mode;
+    allocation_lock = &header_->lock;
+    if (mode != MM_POOL_SHARED) header_->clean = 0;
+    if (!init_lock) return;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    if (mode == MM_POOL_SHARED) {
+        // Other processes lock it too, and must not hang if one of them dies holding it
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    }
+    pthread_mutex_init(allocation_lock, &attr); // Initialize the mutex
+    pthread_mutexattr_destroy(&attr);
+}
+
+// Unmaps the pool and clears the globals
+static void detach_mapping() {
+    if (pool_mode_ != MM_POOL_SHARED) pthread_mutex_destroy(allocation_lock); // Destroy mutex
+    munmap(header_, map_size_); // Unmap the pool together with its node table
+    header_ = NULL;
+    nodes_ = NULL;
+    memory_ = NULL;
+    allocation_lock = NULL;
+    size_ = 0;     // Reset size to 0
+    pool_fd_ = -1;
+}
+
+// Locks the pool. A robust shared mutex reports EOWNERDEAD when its owner died;
+// blocks are published into the list with single release stores, so the list a
+// dead process leaves behind is still well formed and the lock can be reused.
+void lock_pool() {
+    if (pthread_mutex_lock(allocation_lock) == EOWNERDEAD) pthread_mutex_consistent(allocation_lock);
+}
+
+int commit_nodes(uint64_t commit) {
+    if (commit > header_->node_reserve) return -1;
+    if (commit <= header_->node_commit) return 0;
+
+    size_t old_end = committed_size(header_, header_->node_commit);
+    size_t new_end = committed_size(header_, commit);
+    if (new_end > old_end) {
+        if (pool_fd_ >= 0) {
+            if (ftruncate(pool_fd_, new_end) != 0) return -1;
+        } else if (mprotect((char *)header_ + old_end, new_end - old_end, PROT_READ | PROT_WRITE) != 0) {
+            return -1;
+        }
+    }
+    header_->node_commit = commit;
+    return 0;
+}
+
+// Doubles the committed part of the node table, called with the lock held
+static int grow_nodes() {
+    uint64_t commit = header_->node_commit * 2;
+    if (commit > header_->node_reserve) commit = header_->node_reserve;
+    if (commit == header_->node_commit) return -1; // Table is at its reserved maximum
+    return commit_nodes(commit);
+}
+
+// The start index hashes block starts into node_commit buckets. It only holds
+// derived data: whenever node_commit changes, or a process died rebuilding it,
+// index_buckets no longer matches and the next user rebuilds it from the list.
+
+static uint32_t index_bucket(size_t start) {
+    return (uint32_t)(((uint64_t)start * 0x9e3779b97f4a7c15ULL) >> 32) % header_->index_buckets;
+}
+
+// Adds node @p index to its bucket unless it is there already, lock held
+static void index_add(uint32_t index) {
+    uint32_t *link = &nodes_[index_bucket(nodes_[index].start)].bucket;
+    for (uint32_t i = *link; i != MM_NIL; i = nodes_[i].chain)
+        if (i == index) return;
+    nodes_[index].chain = *link;
+    *link = index;
+}
+
+// Rebuilds the start index from the block list for the committed table, lock held
+static void index_rebuild() {
+    header_->index_buckets = 0; // Stays stale if this process dies in here
+    for (uint64_t i = 0; i < header_->node_commit; i++) nodes_[i].bucket = MM_NIL;
+    header_->index_buckets = header_->node_commit;
+    for (uint32_t i = header_->head; i != MM_NIL; i = nodes_[i].next) index_add(i);
+}
+
+static void index_ready() {
+    if (header_->index_buckets != header_->node_commit) index_rebuild();
+}
+
+// Node of the block starting at @p offset, MM_NIL if there is none, lock held
+static uint32_t index_find(size_t offset) {
+    index_ready();
+    uint32_t i = nodes_[index_bucket(offset)].bucket;
+    while (i != MM_NIL && nodes_[i].start != offset) i = nodes_[i].chain;
+    return i;
 }
 
-// Mutex for managing concurrent access to the memory manager
-pthread_mutex_t allocation_lock;
+static void index_remove(uint32_t index) {
+    index_ready();
+    uint32_t *link = &nodes_[index_bucket(nodes_[index].start)].bucket;
+    while (*link != MM_NIL && *link != index) link = &nodes_[*link].chain;
+    if (*link == index) *link = nodes_[index].chain;
+}
+
+static uint32_t memory_block_factory(size_t start, size_t end, uint32_t next, unsigned tag) {
+    uint32_t index = header_->free_nodes;
+    if (index != MM_NIL) {
+        header_->free_nodes = nodes_[index].next; // Reuse a recycled node
+    } else {
+        if (header_->node_used == header_->node_commit && grow_nodes() != 0) return MM_NIL;
+        index = (uint32_t)header_->node_used++;
+    }
+
+    // Initialize block's properties
+    nodes_[index].start = start;
+    nodes_[index].end = end;
+    nodes_[index].next = next;
+    nodes_[index].tag = tag;
+    index_ready();
+    index_add(index);
+    return index;
+}
 
-// Head of the linked list of memory blocks
-memory_block *head;
-void *memory_;     // Pointer to the start of the managed memory
-size_t size_;      // Total size of the managed memory
+// Returns a node to the recycle chain
+static void memory_block_release(uint32_t index) {
+    index_remove(index);
+    nodes_[index].next = header_->free_nodes;
+    header_->free_nodes = index;
+}
 
 // Initialize the memory manager with a given size
 void mem_init(size_t size) {
-    head = NULL;             // Initialize the list as empty
-    memory_ = malloc(size);  // Allocate the memory pool
-    if (!memory_) return;    // Handle failure if malloc fails
-    size_ = size;            // Set the size of the memory pool
-    pthread_mutex_init(&allocation_lock, NULL); // Initialize the mutex
+    mem_init_config(size, NULL);
 }
 
-// Core allocation function, shared by mem_alloc and mem_alloc__nolock__
-void *mem_alloc_core(size_t size, int lock_needed) {
-    if (size > size_) return NULL; // If requested size is larger than available memory, return NULL
-    if (size == 0) return memory_; // Special case: if size is 0, return the base memory address
+int mem_init_config(size_t size, const mem_config *config) {
+    mem_backend backend = config ? config->backend : MEM_BACKEND_LIST;
+    if (backend > MEM_BACKEND_SORTED ||
+        (backend == MEM_BACKEND_TLSF && !tlsf_pool_valid(size))) {
+        errno = EINVAL;
+        return -1;
+    }
+    mm_header layout;
+    header_layout(&layout, size, backend);
+    size_t map_size = committed_size(&layout, layout.node_reserve);
 
-    if (lock_needed) pthread_mutex_lock(&allocation_lock); // Lock if needed for thread-safety
+    // Reserve address space for the worst-case node table but only back what is in use
+    char *base = mmap(NULL, map_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return -1; // Handle failure if mmap fails
+    if (mprotect(base, committed_size(&layout, layout.node_commit), PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, map_size);
+        return -1;
+    }
+    memcpy(base, &layout, sizeof(layout));
+    attach_mapping(base, map_size, -1, MM_POOL_HEAP, 1);
+    if (backend == MEM_BACKEND_TLSF) tlsf_init();
+    if (config && config->maintenance_interval_ms && maintenance_start(config->maintenance_interval_ms) != 0) {
+        detach_mapping();
+        return -1;
+    }
+    return 0;
+}
+
+int mem_init_file(const char *path, size_t size) {
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) goto fail;
 
-    // Check if the block can fit at the start of memory
-    if (head == NULL || (head->start - memory_) >= size) {
-        // Create a new block and set it as the head
-        memory_block *new_block = memory_block_factory(memory_, memory_ + size, head);
-        if (!new_block) {
-            if (lock_needed) pthread_mutex_unlock(&allocation_lock); // Unlock and return NULL if allocation fails
-            return NULL;
+    mm_header layout;
+    int existing = st.st_size > 0;
+    if (existing) {
+        if (pread(fd, &layout, sizeof(layout), 0) != sizeof(layout) || !header_valid(&layout, size, st.st_size)) {
+            errno = EINVAL;
+            goto fail;
         }
-        head = new_block; // Update head
-        if (lock_needed) pthread_mutex_unlock(&allocation_lock); // Unlock if needed
-        return memory_;
+    } else {
+        if (size == 0) {
+            errno = EINVAL;
+            goto fail;
+        }
+        header_layout(&layout, size, MEM_BACKEND_LIST);
+        if (ftruncate(fd, committed_size(&layout, layout.node_commit)) != 0) goto fail;
+    }
+
+    size_t map_size = committed_size(&layout, layout.node_reserve);
+    char *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) goto fail;
+
+    if (!existing) {
+        memcpy(base, &layout, sizeof(layout));
+    }
+    int was_clean = ((mm_header *)base)->clean;
+    // The lock in the file belonged to the previous owner of the pool, start over with a fresh one
+    attach_mapping(base, map_size, fd, MM_POOL_FILE, 1);
+
+    // A pool that was not closed by mem_deinit may have been cut off mid-update
+    if (!was_clean && existing && mem_check() != 0) {
+        detach_mapping();
+        errno = EINVAL;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+int mem_init_shared(const char *name, size_t size) {
+    mm_header layout;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    int creator = fd >= 0;
+    if (creator) {
+        if (size == 0) {
+            errno = EINVAL;
+            goto fail;
+        }
+        header_layout(&layout, size, MEM_BACKEND_LIST);
+        layout.magic = 0; // Attaching processes wait until the finished header is published
+        if (ftruncate(fd, committed_size(&layout, layout.node_commit)) != 0) goto fail;
+    } else {
+        if (errno != EEXIST) return -1;
+        fd = shm_open(name, O_RDWR, 0600);
+        if (fd < 0) return -1;
+
+        // Wait for the creating process to publish the header
+        struct stat st;
+        int waited_ms = 0;
+        while (1) {
+            if (fstat(fd, &st) != 0) goto fail;
+            if (st.st_size >= (off_t)sizeof(layout) && pread(fd, &layout, sizeof(layout), 0) == sizeof(layout) &&
+                layout.magic == MM_MAGIC)
+                break;
+            if (waited_ms++ >= MM_ATTACH_TIMEOUT_MS) {
+                errno = ETIMEDOUT;
+                goto fail;
+            }
+            usleep(1000);
+        }
+        if (!header_valid(&layout, size, st.st_size)) {
+            errno = EINVAL;
+            goto fail;
+        }
+    }
+
+    size_t map_size = committed_size(&layout, layout.node_reserve);
+    char *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) goto fail;
+
+    if (creator) {
+        memcpy(base, &layout, sizeof(layout));
+        attach_mapping(base, map_size, fd, MM_POOL_SHARED, 1);
+        __atomic_store_n(&header_->magic, MM_MAGIC, __ATOMIC_RELEASE);
+    } else {
+        attach_mapping(base, map_size, fd, MM_POOL_SHARED, 0);
+    }
+    return 0;
+
+fail:
+    if (creator) shm_unlink(name);
+    close(fd);
+    return -1;
+}
+
+size_t mem_offset(const void *ptr) {
+    return (const char *)ptr - memory_;
+}
+
+void *mem_at(size_t offset) {
+    return memory_ + offset;
+}
+
+int mem_check() {
+    if (!header_) return -1;
+    if (header_->backend == MEM_BACKEND_TLSF) return tlsf_check();
+    if (header_->backend == MEM_BACKEND_SORTED) return sorted_check();
+    uint64_t seen = 0;
+    size_t last_end = 0;
+    for (uint32_t i = header_->head; i != MM_NIL; i = nodes_[i].next) {
+        // Bounded by node_used so a cycle is reported instead of looping forever
+        if (i >= header_->node_used || ++seen > header_->node_used) return -1;
+        memory_block *block = &nodes_[i];
+        if (block->start < last_end || block->end <= block->start || block->end > size_ || block->tag >= MEM_TAG_COUNT) return -1;
+        last_end = block->end;
+    }
+    // A start index that is up to date has to lead to every block
+    if (header_->index_buckets == header_->node_commit)
+        for (uint32_t i = header_->head; i != MM_NIL; i = nodes_[i].next)
+            if (index_find(nodes_[i].start) != i) return -1;
+    return 0;
+}
+
+void free_ranges(mm_range_fn fn, void *arg) {
+    if (header_->backend != MEM_BACKEND_LIST) {
+        if (header_->backend == MEM_BACKEND_TLSF) tlsf_free_ranges(fn, arg);
+        else sorted_free_ranges(fn, arg);
+        return;
+    }
+    // Gaps between the blocks of the list and behind the last one
+    size_t gap_start = 0;
+    for (uint32_t i = header_->head;; i = nodes_[i].next) {
+        size_t limit = i != MM_NIL ? nodes_[i].start : size_;
+        if (limit > gap_start && fn(gap_start, limit, arg)) return;
+        if (i == MM_NIL) return;
+        gap_start = nodes_[i].end;
+    }
+}
+
+void mem_set_root(void *root) {
+    if (!header_) return; // No pool to record it in
+    header_->root = root ? (uint64_t)((char *)root - memory_) : MM_NO_ROOT;
+}
+
+void *mem_get_root() {
+    if (!header_ || header_->root == MM_NO_ROOT) return NULL;
+    return memory_ + header_->root;
+}
+
+// Offset of the first byte at or after @p offset whose address is a multiple of @p alignment
+static size_t align_offset(size_t offset, size_t alignment) {
+    uintptr_t address = (uintptr_t)memory_ + offset;
+    return offset + (alignment - address % alignment) % alignment;
+}
+
+// Whether @p size bytes starting at @p start end at or before @p limit
+static int fits(size_t start, size_t limit, size_t size) {
+    return start <= limit && limit - start >= size;
+}
+
+// Adds a block of @p bytes to the usage of @p tag, lock held
+static void tag_add(unsigned tag, uint64_t bytes) {
+    header_->tags[tag].bytes += bytes;
+    header_->tags[tag].blocks++;
+}
+
+// Takes a block of @p bytes off the usage of @p tag, lock held
+static void tag_remove(unsigned tag, uint64_t bytes) {
+    header_->tags[tag].bytes -= bytes;
+    header_->tags[tag].blocks--;
+}
+
+// Size and tag of the live block at @p ptr of a TLSF or sorted pool, 0 if there is none there
+static size_t backend_block_size(const void *ptr, unsigned *tag) {
+    return header_->backend == MEM_BACKEND_TLSF ? tlsf_block_size(ptr, tag) : sorted_block_size(ptr, tag);
+}
+
+// First fit on the block list behind node @p *after, or from the start of the
+// pool if it is MM_NIL; *after then names the new block. Lock held.
+static void *list_alloc_after(uint32_t *after, size_t size, size_t alignment, unsigned tag) {
+    uint32_t walker = *after;
+    if (walker == MM_NIL) {
+        // Check if the block can fit at the start of memory
+        uint32_t head = header_->head;
+        size_t start = align_offset(0, alignment);
+        if (fits(start, head == MM_NIL ? size_ : nodes_[head].start, size)) {
+            // Create a new block and set it as the head
+            uint32_t new_block = memory_block_factory(start, start + size, head, tag);
+            if (new_block == MM_NIL) return NULL;
+            __atomic_store_n(&header_->head, new_block, __ATOMIC_RELEASE); // Update head
+            tag_add(tag, size);
+            *after = new_block;
+            return memory_ + start;
+        }
+        walker = head;
     }
 
     // Traverse linked list to find available space between or after blocks
-    memory_block *walker = head;
-    while (walker != NULL) {
-        size_t space = (walker->next) ? walker->next->start - walker->end : memory_ + size_ - walker->end;
-        if (space >= size) { // Found space for the new block
+    while (walker != MM_NIL) {
+        memory_block *block = &nodes_[walker];
+        size_t limit = (block->next != MM_NIL) ? nodes_[block->next].start : size_;
+        size_t start = align_offset(block->end, alignment);
+        if (fits(start, limit, size)) { // Found space for the new block
             // Create and insert a new memory block in the free space
-            memory_block *new_block = memory_block_factory(walker->end, walker->end + size, walker->next);
-            if (!new_block) {
-                if (lock_needed) pthread_mutex_unlock(&allocation_lock);
-                return NULL;
-            }
-            walker->next = new_block;
-            void *ret_val = walker->end;
-            if (lock_needed) pthread_mutex_unlock(&allocation_lock); // Unlock if needed
-            return ret_val;
+            uint32_t new_block = memory_block_factory(start, start + size, block->next, tag);
+            if (new_block == MM_NIL) return NULL;
+            __atomic_store_n(&block->next, new_block, __ATOMIC_RELEASE);
+            tag_add(tag, size);
+            *after = new_block;
+            return memory_ + start;
         }
-        walker = walker->next; // Move to the next block
+        walker = block->next; // Move to the next block
     }
+    return NULL; // No suitable space was found
+}
 
-    if (lock_needed) pthread_mutex_unlock(&allocation_lock); // Unlock if needed
-    return NULL; // Return NULL if no suitable space was found
+// Core allocation function, shared by mem_alloc, mem_alloc_aligned, mem_alloc_tagged and mem_resize
+void *mem_alloc_core(size_t size, size_t alignment, int lock_needed, unsigned tag) {
+    if (size > size_) return NULL; // If requested size is larger than available memory, return NULL
+    if (size == 0) return memory_; // Special case: if size is 0, return the base memory address
+
+    if (lock_needed) lock_pool(); // Lock if needed for thread-safety
+
+    void *ptr;
+    if (header_->backend != MEM_BACKEND_LIST) {
+        ptr = header_->backend == MEM_BACKEND_TLSF ? tlsf_alloc(size, alignment, tag) : sorted_alloc(size, alignment, tag);
+        if (ptr) tag_add(tag, backend_block_size(ptr, &tag));
+    } else {
+        uint32_t after = MM_NIL;
+        ptr = list_alloc_after(&after, size, alignment, tag);
+    }
+    if (lock_needed) {
+        pressure_update();
+        pthread_mutex_unlock(allocation_lock); // Unlock if needed
+    }
+    return ptr;
 }
 
 // Thread-safe memory allocation function
 void *mem_alloc(size_t size) {
-    return mem_alloc_core(size, 1); // Call core function with lock
+    void *ptr = mem_alloc_core(size, 1, 1, 0); // Call core function with lock
+    pressure_notify();
+    return ptr;
 }
 
-// No-lock allocation function (used internally in mem_resize)
-void *mem_alloc__nolock__(size_t size) {
-    return mem_alloc_core(size, 0); // Call core function without lock
+// Thread-safe allocation at an address that is a multiple of alignment
+void *mem_alloc_aligned(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) return NULL; // Alignment must be a power of two
+    void *ptr = mem_alloc_core(size, alignment, 1, 0);
+    pressure_notify();
+    return ptr;
 }
 
-// Frees a block of allocated memory
-void mem_free(void *block) {
-    if (!block) return; // Do nothing if block is NULL
+// Allocates once a trylock or timedlock returned @p rc, errno explains a NULL result
+static void *alloc_after_lock(size_t size, int rc) {
+    if (rc == EOWNERDEAD) pthread_mutex_consistent(allocation_lock);
+    else if (rc != 0) { // EBUSY or ETIMEDOUT, the lock is not ours
+        errno = rc;
+        return NULL;
+    }
+    void *ptr = mem_alloc_core(size, 1, 0, 0);
+    pressure_update();
+    pthread_mutex_unlock(allocation_lock);
+    pressure_notify();
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+// Allocation that gives up instead of waiting for the lock
+void *mem_try_alloc(size_t size) {
+    if (!header_) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return alloc_after_lock(size, pthread_mutex_trylock(allocation_lock));
+}
+
+// Allocation that waits for the lock until an absolute deadline at most
+void *mem_alloc_timed(size_t size, const struct timespec *deadline) {
+    if (!header_) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return alloc_after_lock(size, pthread_mutex_timedlock(allocation_lock, deadline));
+}
+
+// Thread-safe allocation counted under a caller-chosen tag
+void *mem_alloc_tagged(size_t size, unsigned tag) {
+    if (tag >= MEM_TAG_COUNT) return NULL;
+    void *ptr = mem_alloc_core(size, 1, 1, tag);
+    pressure_notify();
+    return ptr;
+}
+
+int mem_tag_stats(unsigned tag, mem_tag_usage *usage) {
+    if (!header_ || tag >= MEM_TAG_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_pool(); // Both counters from the same moment
+    usage->live_bytes = header_->tags[tag].bytes;
+    usage->blocks = header_->tags[tag].blocks;
+    pthread_mutex_unlock(allocation_lock);
+    return 0;
+}
+
+bool mem_owns(const void *ptr) {
+    return memory_ && (const char *)ptr >= memory_ && (const char *)ptr < memory_ + size_;
+}
+
+size_t mem_usable_size(const void *ptr) {
+    if (!mem_owns(ptr)) return 0;
+    size_t usable = 0;
+    lock_pool();
+    if (header_->backend != MEM_BACKEND_LIST) {
+        unsigned tag;
+        usable = backend_block_size(ptr, &tag);
+    } else {
+        uint32_t i = index_find((const char *)ptr - memory_);
+        if (i != MM_NIL) usable = nodes_[i].end - nodes_[i].start;
+    }
+    pthread_mutex_unlock(allocation_lock);
+    return usable;
+}
 
-    pthread_mutex_lock(&allocation_lock); // Lock to ensure thread-safety
+// Frees a block with the lock held, shared by mem_free and mem_free_batch
+static void free_block(void *block) {
+    if (!block) return; // Do nothing if block is NULL
+    size_t offset = (char *)block - memory_;
 
-    if (!head) { // No blocks allocated, nothing to free
-        pthread_mutex_unlock(&allocation_lock);
+    if (header_->backend != MEM_BACKEND_LIST) {
+        unsigned tag;
+        size_t bytes = backend_block_size(block, &tag);
+        if (bytes) { // Otherwise not a live block, nothing to free
+            if (header_->backend == MEM_BACKEND_TLSF) tlsf_free(block);
+            else sorted_free(block);
+            tag_remove(tag, bytes);
+            pressure_update();
+        }
         return;
     }
 
-    if (head->start == block) { // Free the head node if it matches
-        memory_block *temp = head;
-        head = head->next;
-        free(temp); // Free the block memory
+    uint32_t head = header_->head;
+    if (head == MM_NIL) return; // No blocks allocated, nothing to free
+
+    if (nodes_[head].start == offset) { // Free the head node if it matches
+        header_->head = nodes_[head].next;
+        tag_remove(nodes_[head].tag, nodes_[head].end - nodes_[head].start);
+        memory_block_release(head); // Recycle the block's node
+        pressure_update();
     } else { // Traverse to find and free the matching block
-        memory_block *walker = head;
-        while (walker->next != NULL) {
-            if (walker->next->start == block) {
-                memory_block *temp = walker->next;
-                walker->next = temp->next;
-                free(temp); // Free the found block
+        uint32_t walker = head;
+        while (nodes_[walker].next != MM_NIL) {
+            uint32_t next = nodes_[walker].next;
+            if (nodes_[next].start == offset) {
+                nodes_[walker].next = nodes_[next].next;
+                tag_remove(nodes_[next].tag, nodes_[next].end - nodes_[next].start);
+                memory_block_release(next); // Recycle the found block's node
+                pressure_update();
                 break;
             }
-            walker = walker->next;
+            walker = next;
         }
     }
-    pthread_mutex_unlock(&allocation_lock); // Unlock after freeing
+}
+
+// Frees a block of allocated memory
+void mem_free(void *block) {
+    if (!block || !header_) return; // Do nothing if block is NULL or there is no pool
+    lock_pool(); // Lock to ensure thread-safety
+    free_block(block);
+    pthread_mutex_unlock(allocation_lock); // Unlock after freeing
+}
+
+// Allocates @p count blocks under one lock, all of them or none
+int mem_alloc_batch(size_t size, size_t count, void **blocks, unsigned tag) {
+    if (!header_ || size == 0 || tag >= MEM_TAG_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_pool();
+    size_t done = 0;
+    // Blocks of one size go in address order: each search starts behind the
+    // previous block, as the gaps before it were too small, so the batch costs
+    // one walk over the blocks instead of one per block
+    uint32_t after = MM_NIL;
+    uint64_t from = 0;
+    for (; done < count; done++) {
+        void *block;
+        if (header_->backend == MEM_BACKEND_LIST) {
+            block = list_alloc_after(&after, size, 1, tag);
+        } else if (header_->backend == MEM_BACKEND_SORTED) {
+            block = sorted_alloc_from(&from, size, 1, tag);
+            if (block) tag_add(tag, size);
+        } else {
+            block = mem_alloc_core(size, 1, 0, tag); // TLSF finds a block without walking
+        }
+        if (!(blocks[done] = block)) break;
+    }
+    if (done < count) { // Give back what fit
+        while (done) free_block(blocks[--done]);
+        pthread_mutex_unlock(allocation_lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    pressure_update();
+    pthread_mutex_unlock(allocation_lock);
+    pressure_notify();
+    return 0;
+}
+
+// Frees @p count blocks under one lock
+void mem_free_batch(void **blocks, size_t count) {
+    if (count == 0 || !header_) return;
+    lock_pool();
+    for (size_t i = 0; i < count; i++) free_block(blocks[i]);
+    pthread_mutex_unlock(allocation_lock);
 }
 
 // Resizes an allocated memory block, allocating new space if needed
@@ -131,52 +682,74 @@ void *mem_resize(void *block, size_t size) {
         mem_free(block); // Free if size is zero
         return NULL;
     }
+    size_t offset = (char *)block - memory_;
 
-    pthread_mutex_lock(&allocation_lock); // Lock for thread-safety
+    lock_pool(); // Lock for thread-safety
+
+    if (header_->backend != MEM_BACKEND_LIST) {
+        unsigned tag;
+        size_t old_bytes = backend_block_size(block, &tag);
+        void *newblock = old_bytes ? (header_->backend == MEM_BACKEND_TLSF ? tlsf_resize(block, size) : sorted_resize(block, size)) : NULL;
+        if (newblock) {
+            tag_remove(tag, old_bytes);
+            tag_add(tag, backend_block_size(newblock, &tag));
+            pressure_update();
+        }
+        pthread_mutex_unlock(allocation_lock);
+        pressure_notify();
+        return newblock;
+    }
 
     // Traverse list to find the block and the previous node
-    memory_block *before_node = NULL;
-    memory_block *node = head;
-    while (node != NULL && node->start != block) {
+    uint32_t before_node = MM_NIL;
+    uint32_t node = header_->head;
+    while (node != MM_NIL && nodes_[node].start != offset) {
         before_node = node;
-        node = node->next;
+        node = nodes_[node].next;
     }
 
-    if (!node) { // If block isn't found, return NULL
-        pthread_mutex_unlock(&allocation_lock);
+    if (node == MM_NIL) { // If block isn't found, return NULL
+        pthread_mutex_unlock(allocation_lock);
         return NULL;
     }
 
-    if (before_node) before_node->next = node->next; // Unlink node
-    else head = head->next;
+    uint32_t after_node = nodes_[node].next;
+    if (before_node != MM_NIL) nodes_[before_node].next = after_node; // Unlink node
+    else header_->head = after_node;
 
-    // Allocate new block with the specified size
-    void *newblock = mem_alloc__nolock__(size);
+    // Allocate new block with the specified size, it keeps the tag
+    void *newblock = mem_alloc_core(size, 1, 0, nodes_[node].tag);
     if (!newblock) { // If allocation failed, restore original linkage and return NULL
-        if (before_node) before_node->next = node;
-        else head = node;
-        pthread_mutex_unlock(&allocation_lock);
+        if (before_node != MM_NIL) nodes_[before_node].next = node;
+        else header_->head = node;
+        index_ready();
+        index_add(node); // A rebuild while it was unlinked dropped it
+        pthread_mutex_unlock(allocation_lock);
         return NULL;
     }
 
     // Copy data from old block to new block, free old block, and unlock
-    size_t old_size = node->end - node->start;
-    memcpy(newblock, block, (old_size < size) ? old_size : size); // Copy minimum of old and new sizes
-    free(node);
-    pthread_mutex_unlock(&allocation_lock);
+    size_t old_size = nodes_[node].end - nodes_[node].start;
+    memmove(newblock, block, (old_size < size) ? old_size : size); // Copy minimum of old and new sizes, ranges may overlap
+    tag_remove(nodes_[node].tag, old_size);
+    memory_block_release(node);
+    pressure_update();
+    pthread_mutex_unlock(allocation_lock);
+    pressure_notify();
     return newblock;
 }
 
-// Deinitializes the memory manager, freeing all allocated blocks and resources
+// Deinitializes the memory manager, releasing the mapping and resources
 void mem_deinit() {
-    memory_block *walker = head;
-    while (walker != NULL) {
-        memory_block *temp = walker;
-        walker = walker->next;
-        free(temp); // Free each memory block in the linked list
+    if (!header_) return;
+    maintenance_stop();
+    pressure_reset();
+    if (pool_mode_ == MM_POOL_FILE) {
+        // Leave the file consistent so the next mem_init_file can skip the full check
+        header_->clean = 1;
+        msync(header_, committed_size(header_, header_->node_commit), MS_SYNC);
     }
-    free(memory_); // Free the main memory pool
-    size_ = 0;     // Reset size to 0
-    head = NULL;   // Set head to NULL, indicating empty memory
-    pthread_mutex_destroy(&allocation_lock); // Destroy mutex
+    snapshot_untrack();
+    if (pool_fd_ >= 0) close(pool_fd_);
+    detach_mapping();
 }
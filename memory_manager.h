@@ -5,20 +5,251 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+/// @brief Allocation strategies a pool can be managed with
+typedef enum mem_backend {
+    MEM_BACKEND_LIST, ///< First fit over an address-ordered block list, the default
+    MEM_BACKEND_TLSF, ///< Two-level segregated fit: O(1) alloc and free, 16 byte header per block
+    MEM_BACKEND_SORTED, ///< First fit over sorted arrays of block starts and sizes, binary search on free
+} mem_backend;
+
+/// @brief Number of tags mem_alloc_tagged accepts; blocks from mem_alloc carry tag 0
+#define MEM_TAG_COUNT 16
+
+/// @brief Live blocks carrying one tag, as reported by mem_tag_stats
+typedef struct mem_tag_usage {
+    size_t live_bytes; ///< Bytes of those blocks as the backend sizes them, TLSF rounds up to 16
+    size_t blocks;     ///< Number of those blocks
+} mem_tag_usage;
+
+/// @brief Number of thresholds mem_pressure_register accepts per pool
+#define MEM_PRESSURE_MAX 8
+
+/// @brief Called by mem_pressure_register watches with the threshold that was crossed
+typedef void (*mem_pressure_fn)(unsigned percent, void* arg);
+
+/// @brief Options for mem_init_config; zero-initialize and set what you need
+typedef struct mem_config {
+    mem_backend backend;              ///< Strategy managing the pool
+    unsigned maintenance_interval_ms; ///< Period of the background thread releasing free pages, 0 for none
+} mem_config;
 
 /// @brief Initiates the memory mannager with @p size bytes of memory
 /// @param size bytes that will be available in the memory manager
 void mem_init(size_t size);
 
+/// @brief Initiates the memory manager with @p size bytes of memory managed as
+/// described by @p config. With MEM_BACKEND_TLSF the block headers and a
+/// rounding to 16 bytes come out of the @p size bytes, and allocation, free
+/// and resize take constant time however many blocks are live. With
+/// MEM_BACKEND_SORTED the block metadata is kept in contiguous sorted arrays,
+/// which mem_free and mem_resize bisect instead of walking.
+/// A nonzero maintenance_interval_ms starts a thread that periodically hands
+/// whole free pages of the pool back to the kernel. It only works while the
+/// pool lock is free, releases a bounded number of pages per pass and is
+/// stopped by mem_deinit.
+/// @param size bytes that will be available in the memory manager
+/// @param config options, NULL for the defaults used by mem_init
+/// @return 0 on success, -1 with errno set otherwise
+int mem_init_config(size_t size, const mem_config *config);
+
+/// @brief Initiates the memory manager with a pool mapped from the file at
+/// @p path. If the file holds a pool created by an earlier call, that pool is
+/// reopened with all of its allocations intact; otherwise a new pool of
+/// @p size bytes is created. Block metadata is stored as offsets inside the
+/// file, so the pool may be mapped at a different address on every open.
+/// @param path file backing the pool, created if missing
+/// @param size bytes available in a new pool, 0 to accept the size of an
+/// existing pool
+/// @return 0 on success, -1 with errno set if the file could not be mapped or
+/// failed the integrity check
+int mem_init_file(const char *path, size_t size);
+
+/// @brief Initiates the memory manager with a pool in the POSIX shared memory
+/// object @p name, so cooperating processes can allocate and free from the same
+/// pool. The first process creates the object with @p size bytes; later ones
+/// attach to it and wait until the creator has finished setting it up. The
+/// pool lock is a robust process-shared mutex kept inside the object.
+/// mem_deinit detaches; remove the object with shm_unlink once all are done.
+/// @param name shared memory object name, starting with '/'
+/// @param size bytes available if the pool is created, 0 to attach only
+/// @return 0 on success, -1 with errno set otherwise
+int mem_init_shared(const char *name, size_t size);
+
+/// @brief Stops the maintenance thread started through
+/// mem_config.maintenance_interval_ms from working on the pool until
+/// mem_maintenance_resume. Returns once a pass in progress has finished.
+void mem_maintenance_pause();
+
+/// @brief Lets a paused maintenance thread continue, starting with a pass right away
+void mem_maintenance_resume();
+
+/// @brief Calls @p fn once the live blocks fill @p percent of the pool, so
+/// caches can shed load before allocations start failing. It fires once per
+/// crossing: again only after usage has dropped below the threshold and then
+/// risen past it, and right away if the pool is already past it. The thread
+/// whose allocation crossed the threshold runs @p fn after releasing the pool
+/// lock, so @p fn may free or allocate blocks. Watches are dropped by mem_deinit.
+/// @param percent fill level between 1 and 100
+/// @param fn callback, receives @p percent and @p arg
+/// @param arg passed to @p fn
+/// @return 0 on success, -1 with errno set to EINVAL for bad arguments or no
+/// pool, ENOMEM if MEM_PRESSURE_MAX watches are registered
+int mem_pressure_register(unsigned percent, mem_pressure_fn fn, void* arg);
+
+/// @brief Translates a pointer into the pool into an offset that means the
+/// same block in every process attached to the pool
+/// @param ptr pointer returned by mem_alloc
+/// @return offset of @p ptr from the start of the pool
+size_t mem_offset(const void* ptr);
+
+/// @brief Translates an offset from mem_offset back into a pointer valid in
+/// this process
+/// @param offset offset of a block in the pool
+/// @return pointer to the block
+void* mem_at(size_t offset);
+
+/// @brief Writes the pool and its metadata to @p fd as one sequential image,
+/// then starts tracking which pages are written so a later
+/// mem_snapshot_incremental only has to save those. Callers must keep other
+/// threads from writing to their blocks meanwhile.
+///
+/// WARNING: tracking write-protects the block pages of the pool (not the
+/// pages holding the pool header and its lock) until mem_snapshot_stop,
+/// mem_restore or mem_deinit. A write from user space faults once per page
+/// and is let through, but the kernel does not take that fault: read(2),
+/// recv(2) and any other system call writing into a block fail with EFAULT
+/// while tracking is on. Call mem_snapshot_stop before such I/O.
+/// Tracking installs a process-wide SIGSEGV handler; faults outside the pool
+/// go on to the handler that was installed before it, which is put back when
+/// tracking stops.
+/// @param fd file descriptor positioned where the snapshot should go
+/// @return 0 on success, -1 with errno set otherwise
+int mem_snapshot(int fd);
+
+/// @brief Writes only the pages dirtied since the last snapshot, as runs of
+/// consecutive pages. Falls back to a full image if nothing is being tracked
+/// (no earlier snapshot, or a restore since). Restoring it requires the pool
+/// to be in the state of the previous snapshot.
+/// @param fd file descriptor positioned where the snapshot should go
+/// @return 0 on success, -1 with errno set otherwise
+int mem_snapshot_incremental(int fd);
+
+/// @brief Stops the write tracking started by a snapshot: the pool becomes
+/// writable again, also to system calls, and the SIGSEGV handler in place
+/// before is restored. The next mem_snapshot_incremental writes a full image.
+void mem_snapshot_stop(void);
+
+/// @brief Restores the pool from a snapshot in @p fd, which is memory-mapped
+/// and copied into the pool. The pool must have the same size as the one the
+/// snapshot was taken from. Restore a full snapshot first, then the
+/// incremental ones taken after it, in order.
+/// @param fd file descriptor of the snapshot file
+/// @return 0 on success, -1 with errno set if the snapshot does not apply
+int mem_restore(int fd);
+
+/// @brief Checks that the block metadata is consistent (ordered, in bounds and
+/// free of cycles). Runs automatically when a pool file that was not closed
+/// with mem_deinit is reopened.
+/// @return 0 if the metadata is consistent, -1 otherwise
+int mem_check();
+
+/// @brief Records @p root as the entry point of the data kept in the pool, so
+/// it can be found again after a file-backed pool is reopened; does nothing
+/// without a pool
+/// @param root pointer into the pool, or NULL to clear the root
+void mem_set_root(void* root);
+
+/// @brief Returns the pointer stored with mem_set_root, translated to the
+/// current mapping of the pool
+/// @return root pointer or NULL if none was set
+void* mem_get_root();
+
 /// @brief Allocates @p size bytes of memory
 /// @param @p size number of bytes that will be allocated
 /// @return pointer to the allocated memory
 void* mem_alloc(size_t size);
 
+/// @brief Allocates @p size bytes of memory starting at an address that is a
+/// multiple of @p alignment
+/// @param alignment power of two the address must be a multiple of
+/// @param size number of bytes that will be allocated
+/// @return pointer to the allocated memory, NULL if no suitably aligned space
+/// is free or @p alignment is not a power of two
+void* mem_alloc_aligned(size_t alignment, size_t size);
+
+/// @brief Allocates @p size bytes of memory if the pool lock is free right now,
+/// without waiting for another thread's allocation to finish
+/// @param size number of bytes that will be allocated
+/// @return pointer to the allocated memory, or NULL with errno set to EBUSY
+/// if the lock was taken, ENOMEM if the block does not fit or EINVAL if there
+/// is no pool
+void* mem_try_alloc(size_t size);
+
+/// @brief Allocates @p size bytes of memory, waiting for the pool lock no
+/// longer than until @p deadline
+/// @param size number of bytes that will be allocated
+/// @param deadline absolute CLOCK_REALTIME time, as for pthread_mutex_timedlock
+/// @return pointer to the allocated memory, or NULL with errno set to
+/// ETIMEDOUT if the lock was not free in time, ENOMEM if the block does not fit
+/// or EINVAL if there is no pool
+void* mem_alloc_timed(size_t size, const struct timespec* deadline);
+
+/// @brief Allocates @p size bytes of memory and counts the block under @p tag
+/// until it is freed, so pool usage can be attributed to the subsystems
+/// sharing the pool. mem_resize keeps the tag of a block. The counters are
+/// updated while the pool lock is held anyway and live in the pool header.
+/// @param size number of bytes that will be allocated
+/// @param tag caller-chosen tag below MEM_TAG_COUNT
+/// @return pointer to the allocated memory, NULL if it does not fit or
+/// @p tag is out of range
+void* mem_alloc_tagged(size_t size, unsigned tag);
+
+/// @brief Reads the live blocks and bytes allocated under @p tag
+/// @param tag tag below MEM_TAG_COUNT
+/// @param usage filled in with the counters
+/// @return 0 on success, -1 with errno set to EINVAL if @p tag is out of range
+/// or no pool is initialized
+int mem_tag_stats(unsigned tag, mem_tag_usage* usage);
+
+/// @brief Tells whether @p ptr points into the pool, by comparing it with the
+/// pool's bounds only, so it says nothing about whether a block is live there
+/// @param ptr any pointer
+/// @return true if @p ptr lies inside the pool
+bool mem_owns(const void* ptr);
+
+/// @brief Returns how many bytes the block at @p ptr can hold, which may be
+/// more than was requested: TLSF rounds sizes up to 16 bytes. A caller can
+/// use all of it and skip mem_resize while the new size is no larger. With
+/// MEM_BACKEND_TLSF the size is read from the block header and the default
+/// block list looks the block up in a hash index by start offset, both in
+/// constant time; the sorted backend bisects its arrays.
+/// @param ptr pointer returned by an allocation function
+/// @return usable bytes, 0 if @p ptr is not the start of a live block
+size_t mem_usable_size(const void* ptr);
+
 /// @brief Frees @p block preventing memory leaks
 /// @param block
 void mem_free(void* block);
 
+/// @brief Allocates @p count blocks of @p size bytes under @p tag, taking the
+/// pool lock once for all of them. Each block is a block of its own, which
+/// mem_free or mem_free_batch gives back.
+/// @param size bytes of every block
+/// @param count number of blocks
+/// @param blocks array receiving the @p count pointers
+/// @param tag tag below MEM_TAG_COUNT, 0 for untagged blocks
+/// @return 0 on success, -1 with errno set to ENOMEM if not all of them fit,
+/// in which case none is allocated, or EINVAL if @p size is 0, @p tag is out
+/// of range or no pool is initialized
+int mem_alloc_batch(size_t size, size_t count, void** blocks, unsigned tag);
+
+/// @brief Frees @p count blocks, taking the pool lock once for all of them
+/// @param blocks pointers returned by allocation functions, NULL entries are skipped
+/// @param count number of pointers
+void mem_free_batch(void** blocks, size_t count);
+
 /// @brief Changes the size of the allocated block, return NULL if failed
 /// @param block pointer to your allocated memory, if NULL allocates new memory
 /// of @p size
@@ -28,7 +259,8 @@ void mem_free(void* block);
 void* mem_resize(void* block, size_t size);
 
 /// @brief gives back the memory used by the memory manager, makes the memory
-/// mannager unusable until new init
+/// mannager unusable until new init. A file-backed pool is synced and marked
+/// clean, its contents stay in the file
 void mem_deinit();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+// mm_internal.h
+// Pool layout and state shared by the memory manager's translation units
+#ifndef MM_INTERNAL_H
+#define MM_INTERNAL_H
+
+#include "memory_manager.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MM_MAGIC 0x314c4f4f504d4d00ULL // "\0MMPOOL1"
+#define MM_VERSION 6
+#define MM_NIL UINT32_MAX              // Terminates block chains in the node table
+#define MM_NO_ROOT UINT64_MAX          // Root offset when no root object has been set
+#define MM_INITIAL_NODES 256           // Nodes committed up front, the table doubles from there
+
+// Kinds of mapping a pool can live in
+typedef enum { MM_POOL_HEAP, MM_POOL_FILE, MM_POOL_SHARED } mm_pool_mode;
+
+// Struct representing a block of memory. Blocks live in a node table inside the
+// pool mapping and refer to each other by index, so the whole structure stays
+// valid when a file-backed pool is mapped at a different address. Slot i of
+// the table is also bucket i of a hash index from block start to node, which
+// lets mem_usable_size find a block without walking the list.
+typedef struct memory_block {
+    size_t start;    // Offset of the first byte of the block in the pool
+    size_t end;      // Offset one past the last byte of the block
+    uint32_t next;   // Index of the next memory block in address order, MM_NIL ends the list
+    uint32_t tag;    // Tag the block was allocated with, fills what would be padding
+    uint32_t bucket; // First node whose start hashes to this slot, MM_NIL if none
+    uint32_t chain;  // Next node of this node's bucket, MM_NIL ends the chain
+} memory_block;
+
+// Live blocks of one allocation tag
+typedef struct mm_tag_count {
+    uint64_t bytes;
+    uint64_t blocks;
+} mm_tag_count;
+
+// Header stored in the first page of every pool mapping
+typedef struct mm_header {
+    uint64_t magic;        // MM_MAGIC once the pool is fully initialized
+    uint32_t version;      // MM_VERSION of the layout below
+    uint32_t clean;        // Set by mem_deinit, cleared while a process has the pool open
+    uint64_t pool_size;    // Bytes available to mem_alloc
+    uint64_t pool_offset;  // Offset of the pool from the start of the mapping
+    uint64_t node_offset;  // Offset of the node table from the start of the mapping
+    uint64_t node_reserve; // Number of nodes the mapping has address space for
+    uint64_t backend;      // mem_backend managing the pool
+    uint64_t geometry_sum; // Checksum over the fields above
+    uint64_t node_commit;  // Number of nodes backed by memory (or by the file)
+    uint64_t node_used;    // High-water mark of node indices handed out
+    uint64_t index_buckets; // Buckets the start index was built with, it is rebuilt when this is not node_commit
+    uint32_t head;         // First memory block in address order
+    uint32_t free_nodes;   // Chain of recycled node indices
+    uint64_t root;         // Offset of the caller's root object, MM_NO_ROOT if unset
+    uint64_t snapshot_gen; // Number of snapshots taken, incremental snapshots apply on top of the previous one
+    mm_tag_count tags[MEM_TAG_COUNT]; // Usage per allocation tag, updated with the lock held
+    pthread_mutex_t lock;  // allocation_lock points here, process-shared for shared pools
+} mm_header;
+
+extern pthread_mutex_t *allocation_lock;
+extern mm_header *header_;
+extern memory_block *nodes_;
+extern char *memory_;
+extern size_t size_;
+extern size_t map_size_;
+extern int pool_fd_;
+extern mm_pool_mode pool_mode_;
+
+// Rounds @p n up to a whole number of pages
+size_t page_round(size_t n);
+
+// Bytes of the mapping that are backed once @p node_commit nodes are committed
+size_t committed_size(const mm_header *hdr, uint64_t node_commit);
+
+// Backs the node table up to @p commit nodes, called with the lock held
+int commit_nodes(uint64_t commit);
+
+// Locks the pool, recovering the lock if its owner died
+void lock_pool();
+
+// Called for a free range [start, end) of the pool; a nonzero return ends the iteration
+typedef int (*mm_range_fn)(size_t start, size_t end, void *arg);
+
+// Calls @p fn for the free ranges of the pool in address order, lock held
+void free_ranges(mm_range_fn fn, void *arg);
+
+// Two-level segregated fit backend (mm_tlsf.c), its control block follows the
+// header. Everything but the first two is called with the lock held.
+size_t tlsf_metadata_end();
+int tlsf_pool_valid(size_t size);
+void tlsf_init();
+void *tlsf_alloc(size_t size, size_t alignment, unsigned tag);
+void tlsf_free(void *ptr);
+void *tlsf_resize(void *ptr, size_t size);
+size_t tlsf_block_size(const void *ptr, unsigned *tag);
+int tlsf_check();
+void tlsf_free_ranges(mm_range_fn fn, void *arg);
+
+// Sorted array backend (mm_sorted.c), keeps its arrays in the node table, lock held
+void *sorted_alloc(size_t size, size_t alignment, unsigned tag);
+// First fit starting at entry *from, which then names the entry behind the new block
+void *sorted_alloc_from(uint64_t *from, size_t size, size_t alignment, unsigned tag);
+void sorted_free(void *ptr);
+void *sorted_resize(void *ptr, size_t size);
+size_t sorted_block_size(const void *ptr, unsigned *tag);
+int sorted_check();
+void sorted_free_ranges(mm_range_fn fn, void *arg);
+
+// Background page trimming (mm_maintenance.c), started by mem_init_config and stopped by mem_deinit
+int maintenance_start(unsigned interval_ms);
+void maintenance_stop();
+
+// Fill level thresholds (mm_pressure.c): pressure_update marks crossed watches
+// with the lock held, pressure_notify runs their callbacks after unlocking
+void pressure_update();
+void pressure_notify();
+void pressure_reset();
+
+// Drops snapshot dirty tracking before the mapping goes away (mm_snapshot.c)
+void snapshot_untrack();
+
+#endif // MM_INTERNAL_H
@@ -0,0 +1,147 @@
+// mm_maintenance.c
+// Optional background thread returning the pages of free pool space to the kernel
+#include "memory_manager.h"
+#include "mm_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MM_TRIM_MIN_PAGES 16     // Free runs shorter than this are left alone, they are likely reused soon
+#define MM_TRIM_BUDGET_PAGES 256 // Most pages released per pass, the rest waits for the next one
+#define MM_TRIM_SCAN_PAGES 16384 // Most free pages looked at per pass, released or not
+#define MM_TRIM_CHUNK 256        // Pages whose residency one mincore() call reports
+
+// Allocation never waits for maintenance: a pass only runs if the pool lock is
+// free right now, and a pass that finds it taken is skipped. Each pass walks
+// the free ranges from where the previous one stopped and releases at most
+// MM_TRIM_BUDGET_PAGES with madvise(MADV_DONTNEED); the pages read back as
+// zeros and are faulted in again when an allocation uses them. Pages that are
+// not resident, mostly ones an earlier pass released and nothing touched
+// since, are found with mincore() and skipped without using up the budget.
+//
+// Page release is the only deferred work: every backend merges free space
+// when a block is freed and there are no size-class caches to refill.
+
+static pthread_t thread_;
+static int running_;               // Set while the thread exists
+static int stop_;                  // Tells the thread to exit
+static int paused_;
+static unsigned interval_ms_;
+static size_t cursor_;             // Pool offset the next pass continues from
+static pthread_mutex_t state_lock_ = PTHREAD_MUTEX_INITIALIZER; // Held for a whole pass and guards the flags
+static pthread_cond_t wake_ = PTHREAD_COND_INITIALIZER;
+
+typedef struct trim_state {
+    size_t page;
+    size_t budget; // Pages still allowed to be released in this pass
+    size_t scan;   // Pages still allowed to be looked at in this pass
+    size_t resume; // Offset the pass stopped at, 0 if it went through the whole pool
+} trim_state;
+
+// Releases the resident whole pages inside the free range [start, end), stops once the budget or the scan limit is used
+static int trim_range(size_t start, size_t end, void *arg) {
+    trim_state *state = arg;
+    if (end <= cursor_) return 0; // Handled by an earlier pass
+    if (start < cursor_) start = cursor_;
+    uintptr_t first = ((uintptr_t)memory_ + start + state->page - 1) & ~(uintptr_t)(state->page - 1);
+    uintptr_t last = ((uintptr_t)memory_ + end) & ~(uintptr_t)(state->page - 1);
+    if (last <= first || (last - first) / state->page < MM_TRIM_MIN_PAGES) return 0;
+
+    for (uintptr_t at = first; at < last; at += MM_TRIM_CHUNK * state->page) {
+        if (state->scan == 0) {
+            state->resume = at - (uintptr_t)memory_;
+            return 1;
+        }
+        size_t pages = (last - at) / state->page;
+        if (pages > MM_TRIM_CHUNK) pages = MM_TRIM_CHUNK;
+        if (pages > state->scan) pages = state->scan;
+        state->scan -= pages;
+        unsigned char resident[MM_TRIM_CHUNK];
+        if (mincore((void *)at, pages * state->page, resident) != 0) memset(resident, 1, pages); // Unknown, release them all
+
+        for (size_t i = 0; i < pages;) {
+            if (!(resident[i] & 1)) {
+                i++;
+                continue;
+            }
+            size_t run = i + 1;
+            while (run < pages && (resident[run] & 1) && run - i < state->budget) run++;
+            madvise((void *)(at + i * state->page), (run - i) * state->page, MADV_DONTNEED);
+            state->budget -= run - i;
+            if (state->budget == 0) {
+                state->resume = at + run * state->page - (uintptr_t)memory_;
+                return 1;
+            }
+            i = run;
+        }
+    }
+    return 0;
+}
+
+static void maintenance_pass() {
+    int rc = pthread_mutex_trylock(allocation_lock);
+    if (rc == EOWNERDEAD) pthread_mutex_consistent(allocation_lock);
+    else if (rc != 0) return; // Busy, try again next interval
+    trim_state state = {(size_t)sysconf(_SC_PAGESIZE), MM_TRIM_BUDGET_PAGES, MM_TRIM_SCAN_PAGES, 0};
+    free_ranges(trim_range, &state);
+    cursor_ = state.resume;
+    pthread_mutex_unlock(allocation_lock);
+}
+
+static void *maintenance_thread(void *arg) {
+    pthread_mutex_lock(&state_lock_);
+    while (!stop_) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval_ms_ / 1000;
+        deadline.tv_nsec += (long)(interval_ms_ % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        // Sleep out the interval; stop and resume signal early
+        while (!stop_ && pthread_cond_timedwait(&wake_, &state_lock_, &deadline) != ETIMEDOUT)
+            if (!paused_) break;
+        if (!stop_ && !paused_) maintenance_pass();
+    }
+    pthread_mutex_unlock(&state_lock_);
+    return NULL;
+}
+
+int maintenance_start(unsigned interval_ms) {
+    interval_ms_ = interval_ms;
+    stop_ = 0;
+    paused_ = 0;
+    cursor_ = 0;
+    if (pthread_create(&thread_, NULL, maintenance_thread, NULL) != 0) return -1;
+    running_ = 1;
+    return 0;
+}
+
+void maintenance_stop() {
+    if (!running_) return;
+    pthread_mutex_lock(&state_lock_);
+    stop_ = 1;
+    pthread_cond_signal(&wake_);
+    pthread_mutex_unlock(&state_lock_);
+    pthread_join(thread_, NULL);
+    running_ = 0;
+}
+
+void mem_maintenance_pause() {
+    // Taking the lock waits out a pass that is already running
+    pthread_mutex_lock(&state_lock_);
+    paused_ = 1;
+    pthread_mutex_unlock(&state_lock_);
+}
+
+void mem_maintenance_resume() {
+    pthread_mutex_lock(&state_lock_);
+    paused_ = 0;
+    pthread_cond_signal(&wake_);
+    pthread_mutex_unlock(&state_lock_);
+}
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include "memory_manager.h"
+#include "mm_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*=========================================================
+ * malloc replacement serving every allocation of an unmodified program from
+ * the memory manager:
+ *
+ *   LD_PRELOAD=./libmmpreload.so MM_PRELOAD_POOL=256M ./program
+ *
+ * The library is built with hidden visibility, so only the functions marked
+ * EXPORT interpose on libc and the program's own mem_* calls (if any) still
+ * reach libmemory_manager.so with its separate pool.
+ */
+
+#define EXPORT __attribute__((visibility("default")))
+#define PRELOAD_ALIGN 16                   // Alignment malloc guarantees on x86_64
+#define PRELOAD_DEFAULT_POOL (1UL << 30)   // Pool size when MM_PRELOAD_POOL is not set
+#define PRELOAD_BOOTSTRAP_SIZE (64 * 1024) // Serves allocations made while the pool is being set up
+
+enum { PRELOAD_UNINIT, PRELOAD_INITIALIZING, PRELOAD_READY };
+
+static char bootstrap_[PRELOAD_BOOTSTRAP_SIZE] __attribute__((aligned(PRELOAD_ALIGN)));
+static size_t bootstrap_pos_;
+static int state_ = PRELOAD_UNINIT;
+static __thread int in_init_; // Set on the thread running preload_init
+
+// Rounds every request to the malloc alignment; the pool starts page aligned,
+// so every block then starts on a PRELOAD_ALIGN boundary too. Returns 0 on overflow.
+static size_t round_size(size_t size) {
+    if (size > SIZE_MAX - PRELOAD_ALIGN) return 0;
+    if (size == 0) size = 1; // malloc(0) still has to return a unique pointer
+    return (size + PRELOAD_ALIGN - 1) & ~(size_t)(PRELOAD_ALIGN - 1);
+}
+
+static int in_bootstrap(void *ptr) {
+    return (char *)ptr >= bootstrap_ && (char *)ptr < bootstrap_ + sizeof(bootstrap_);
+}
+
+// Hands out memory from the static buffer to calls that re-enter malloc during setup
+static void *bootstrap_alloc(size_t size) {
+    size = round_size(size);
+    size_t pos = __atomic_fetch_add(&bootstrap_pos_, size, __ATOMIC_RELAXED);
+    if (!size || pos + size > sizeof(bootstrap_)) return NULL;
+    return bootstrap_ + pos;
+}
+
+// Parses sizes such as "268435456", "512K", "256M" or "2G"
+static size_t parse_size(const char *text) {
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    switch (*end) {
+    case 'g': case 'G': value <<= 10; // fall through
+    case 'm': case 'M': value <<= 10; // fall through
+    case 'k': case 'K': value <<= 10;
+    }
+    return (size_t)value;
+}
+
+// Fork safety: no other thread may hold the pool lock while the address space
+// is copied. Without a pool (it failed to set up or was torn down) there is no
+// lock, and fork goes on as usual.
+static void atfork_prepare() {
+    if (allocation_lock) lock_pool();
+}
+
+static void atfork_parent() {
+    if (allocation_lock) pthread_mutex_unlock(allocation_lock);
+}
+
+static void atfork_child() {
+    // Only the forking thread exists in the child, start over with a fresh lock
+    if (allocation_lock) pthread_mutex_init(allocation_lock, NULL);
+}
+
+// Sets up the pool on the first allocation; other threads wait until it is ready
+static void preload_init() {
+    int expected = PRELOAD_UNINIT;
+    if (!__atomic_compare_exchange_n(&state_, &expected, PRELOAD_INITIALIZING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&state_, __ATOMIC_ACQUIRE) != PRELOAD_READY) sched_yield();
+        return;
+    }
+
+    in_init_ = 1;
+    const char *env = getenv("MM_PRELOAD_POOL");
+    size_t size = env ? parse_size(env) : 0;
+    mem_init(size ? size : PRELOAD_DEFAULT_POOL);
+    pthread_atfork(atfork_prepare, atfork_parent, atfork_child); // May allocate, served from bootstrap_
+    in_init_ = 0;
+    __atomic_store_n(&state_, PRELOAD_READY, __ATOMIC_RELEASE);
+}
+
+// Common entry for all allocation functions, @p alignment of 0 means the default
+static void *preload_alloc(size_t alignment, size_t size) {
+    if (__atomic_load_n(&state_, __ATOMIC_ACQUIRE) != PRELOAD_READY) {
+        if (in_init_) return bootstrap_alloc(size);
+        preload_init();
+    }
+    size_t rounded = round_size(size);
+    void *ptr = NULL;
+    if (rounded) ptr = alignment > PRELOAD_ALIGN ? mem_alloc_aligned(alignment, rounded) : mem_alloc(rounded);
+    if (!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+EXPORT void *malloc(size_t size) {
+    return preload_alloc(0, size);
+}
+
+EXPORT void free(void *ptr) {
+    // Bootstrap memory is never reused; anything else not in the pool was not ours to begin with
+    if (!ptr || in_bootstrap(ptr) || !memory_) return;
+    mem_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size) {
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = preload_alloc(0, nmemb * size);
+    if (ptr && !in_bootstrap(ptr)) memset(ptr, 0, nmemb * size); // Freed blocks are reused dirty
+    return ptr;
+}
+
+EXPORT void *realloc(void *ptr, size_t size) {
+    if (!ptr) return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    if (in_bootstrap(ptr)) {
+        // The old size is unknown, copy as much as can belong to the allocation
+        void *nptr = malloc(size);
+        size_t available = bootstrap_ + sizeof(bootstrap_) - (char *)ptr;
+        if (nptr) memcpy(nptr, ptr, size < available ? size : available);
+        return nptr;
+    }
+    size_t rounded = round_size(size);
+    void *nptr = rounded ? mem_resize(ptr, rounded) : NULL;
+    if (!nptr) errno = ENOMEM;
+    return nptr;
+}
+
+EXPORT size_t malloc_usable_size(void *ptr) {
+    // The size of a bootstrap allocation is not recorded, 0 is always safe to use
+    if (!ptr || in_bootstrap(ptr)) return 0;
+    return mem_usable_size(ptr);
+}
+
+EXPORT void *memalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return preload_alloc(alignment, size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) return EINVAL;
+    void *ptr = preload_alloc(alignment, size);
+    if (!ptr) return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+EXPORT void *valloc(size_t size) {
+    return memalign((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+EXPORT void *pvalloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
@@ -0,0 +1,74 @@
+// mm_pressure.c
+// Callbacks that tell the application when the pool fills up past a threshold
+#include "memory_manager.h"
+#include "mm_internal.h"
+#include <errno.h>
+
+// Every allocation, resize and free recomputes the fill level from the tag
+// counters once it is done with them, lock still held, and marks the watches
+// whose threshold was just crossed upwards. The thread that made the
+// allocation runs the marked callbacks after it has unlocked, so a callback may
+// free or allocate blocks itself. A watch fires again only after the fill
+// level has dropped below its threshold in between.
+
+typedef struct pressure_watch {
+    unsigned percent;
+    mem_pressure_fn fn;
+    void *arg;
+    int above;   // Fill level was at or above percent after the last update, lock held
+    int pending; // Crossed and not reported yet, claimed atomically by pressure_notify
+} pressure_watch;
+
+static pressure_watch watches_[MEM_PRESSURE_MAX];
+static int watch_count_; // Written with the lock held, read without it by pressure_notify
+
+// Bytes in live blocks, summed over all tags
+static uint64_t used_bytes() {
+    uint64_t used = 0;
+    for (unsigned tag = 0; tag < MEM_TAG_COUNT; tag++) used += header_->tags[tag].bytes;
+    return used;
+}
+
+void pressure_update() {
+    int count = watch_count_;
+    if (!count) return;
+    uint64_t used = used_bytes();
+    for (int i = 0; i < count; i++) {
+        pressure_watch *watch = &watches_[i];
+        int above = used * 100 >= (uint64_t)watch->percent * size_;
+        if (above && !watch->above) __atomic_store_n(&watch->pending, 1, __ATOMIC_RELAXED);
+        watch->above = above;
+    }
+}
+
+void pressure_notify() {
+    int count = __atomic_load_n(&watch_count_, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        pressure_watch *watch = &watches_[i];
+        if (__atomic_load_n(&watch->pending, __ATOMIC_RELAXED) && __atomic_exchange_n(&watch->pending, 0, __ATOMIC_ACQ_REL))
+            watch->fn(watch->percent, watch->arg);
+    }
+}
+
+void pressure_reset() {
+    watch_count_ = 0;
+}
+
+int mem_pressure_register(unsigned percent, mem_pressure_fn fn, void *arg) {
+    if (!header_ || !fn || percent == 0 || percent > 100) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_pool();
+    if (watch_count_ == MEM_PRESSURE_MAX) {
+        pthread_mutex_unlock(allocation_lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    watches_[watch_count_] = (pressure_watch){percent, fn, arg, 0, 0};
+    __atomic_store_n(&watch_count_, watch_count_ + 1, __ATOMIC_RELEASE);
+    pressure_update(); // A pool that is already past the threshold reports it right away
+    pthread_mutex_unlock(allocation_lock);
+    pressure_notify();
+    return 0;
+}
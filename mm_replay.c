@@ -0,0 +1,406 @@
+// mm_replay.c
+// Replays an allocation trace captured by the cM2.c interposer against the
+// memory manager (or glibc malloc with -g) and reports how it performed.
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "cm2_trace.h"
+#include "memory_manager.h"
+#include "common_defs.h"
+
+#define NO_SLOT (-1)
+
+// One allocation event prepared for replay
+typedef struct
+{
+    uint16_t op;
+    uint64_t size;
+    uint64_t alignment; // memalign only
+    int64_t dep;        // Event whose block this one frees or resizes, NO_SLOT if none
+    int64_t stale;      // Event whose block the trace never freed before its address came back, NO_SLOT if none
+    bool produces;      // Whether the event leaves a block behind for a later event
+} replay_event;
+
+// Events of one traced thread, in the order that thread made them
+typedef struct
+{
+    uint32_t tid;
+    size_t *events;
+    size_t count, capacity;
+    pthread_t thread;
+} replay_thread;
+
+typedef struct
+{
+    cm2_record record;
+    size_t index;
+} indexed_record;
+
+static replay_event *events;
+static void **blocks;          // Block produced by each event during replay
+static int *ready;             // Set once blocks[i] is valid, events of other threads may wait on it
+static bool use_libc;
+static my_barrier_t barrier;
+static size_t live_bytes, peak_bytes, pool_high_water, failures;
+
+static int compare_records(const void *a, const void *b)
+{
+    const indexed_record *left = a, *right = b;
+    if (left->record.timestamp != right->record.timestamp)
+        return left->record.timestamp < right->record.timestamp ? -1 : 1;
+    return left->index < right->index ? -1 : left->index > right->index;
+}
+
+/* ********* Open addressing map from traced addresses to the event that allocated them ********* */
+
+typedef struct
+{
+    uint64_t *keys;
+    int64_t *values;
+    size_t mask;
+} address_map;
+
+static void map_init(address_map *map, size_t entries)
+{
+    size_t capacity = 16;
+    while (capacity < entries * 2)
+        capacity *= 2;
+    map->keys = calloc(capacity, sizeof(uint64_t));
+    map->values = malloc(capacity * sizeof(int64_t));
+    map->mask = capacity - 1;
+}
+
+static size_t map_find(address_map *map, uint64_t key)
+{
+    size_t i = (key * 0x9e3779b97f4a7c15ULL >> 17) & map->mask;
+    while (map->keys[i] && map->keys[i] != key)
+        i = (i + 1) & map->mask;
+    return i;
+}
+
+// Sets @p key to @p value and returns the value it replaced, NO_SLOT if @p key was not present
+static int64_t map_put(address_map *map, uint64_t key, int64_t value)
+{
+    size_t i = map_find(map, key);
+    int64_t old = map->keys[i] ? map->values[i] : NO_SLOT;
+    map->keys[i] = key;
+    map->values[i] = value;
+    return old;
+}
+
+// Removes @p key and returns its value, NO_SLOT if it was not present
+static int64_t map_take(address_map *map, uint64_t key)
+{
+    size_t i = map_find(map, key);
+    if (!map->keys[i])
+        return NO_SLOT;
+    int64_t value = map->values[i];
+    // Backward shift deletion keeps the probe sequences of the other keys intact
+    size_t hole = i;
+    map->keys[hole] = 0;
+    for (size_t j = (hole + 1) & map->mask; map->keys[j]; j = (j + 1) & map->mask)
+    {
+        size_t home = (map->keys[j] * 0x9e3779b97f4a7c15ULL >> 17) & map->mask;
+        if (((j - home) & map->mask) >= ((j - hole) & map->mask))
+        {
+            map->keys[hole] = map->keys[j];
+            map->values[hole] = map->values[j];
+            map->keys[j] = 0;
+            hole = j;
+        }
+    }
+    return value;
+}
+
+/* ********* Replay ********* */
+
+static void account(size_t size, void *block, bool allocated)
+{
+    if (!allocated)
+    {
+        __atomic_sub_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+        return;
+    }
+    size_t live = __atomic_add_fetch(&live_bytes, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&peak_bytes, &peak, live, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    if (!use_libc)
+    {
+        size_t end = mem_offset(block) + size;
+        size_t high = __atomic_load_n(&pool_high_water, __ATOMIC_RELAXED);
+        while (end > high && !__atomic_compare_exchange_n(&pool_high_water, &high, end, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+static void *replay_alloc(uint64_t size, uint64_t alignment)
+{
+    if (use_libc)
+        return alignment ? aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) : malloc(size);
+    return alignment ? mem_alloc_aligned(alignment, size) : mem_alloc(size);
+}
+
+// Waits until event @p id of any thread has run and returns its block
+static void *block_of(int64_t id)
+{
+    while (!__atomic_load_n(&ready[id], __ATOMIC_ACQUIRE))
+        sched_yield();
+    return blocks[id];
+}
+
+static void replay_free(void *block, uint64_t size)
+{
+    account(size, block, false);
+    use_libc ? free(block) : mem_free(block);
+}
+
+static void *replay_thread_function(void *arg)
+{
+    replay_thread *thread = arg;
+    my_barrier_wait(&barrier);
+
+    for (size_t i = 0; i < thread->count; i++)
+    {
+        size_t id = thread->events[i];
+        replay_event *event = &events[id];
+        void *old = NULL;
+        if (event->dep != NO_SLOT)
+            old = block_of(event->dep); // From another thread's event that happened earlier in the trace
+        if (event->stale != NO_SLOT)
+        {
+            // The trace lost the free of the block that had this address, release it here instead of leaking it
+            void *stale = block_of(event->stale);
+            if (stale)
+                replay_free(stale, events[event->stale].size);
+        }
+        uint64_t old_size = event->dep != NO_SLOT ? events[event->dep].size : 0;
+
+        void *block = NULL;
+        switch (event->op)
+        {
+        case CM2_OP_MALLOC:
+        case CM2_OP_CALLOC:
+        case CM2_OP_MEMALIGN:
+            block = replay_alloc(event->size, event->op == CM2_OP_MEMALIGN ? event->alignment : 0);
+            if (block && event->op == CM2_OP_CALLOC)
+                memset(block, 0, event->size);
+            break;
+        case CM2_OP_FREE:
+            if (old)
+                replay_free(old, old_size);
+            break;
+        case CM2_OP_REALLOC:
+            if (old)
+                account(old_size, old, false);
+            block = use_libc ? realloc(old, event->size) : mem_resize(old, event->size);
+            if (!block && old)
+                account(old_size, old, true); // The old block stays valid when resizing fails
+            break;
+        }
+
+        if (event->op != CM2_OP_FREE)
+        {
+            if (block)
+                account(event->size, block, true);
+            else if (event->size)
+                __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+        }
+        if (event->produces)
+        {
+            blocks[id] = block;
+            __atomic_store_n(&ready[id], 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+static replay_thread *thread_for(replay_thread **threads, size_t *count, uint32_t tid)
+{
+    for (size_t i = 0; i < *count; i++)
+        if ((*threads)[i].tid == tid)
+            return &(*threads)[i];
+    *threads = realloc(*threads, (*count + 1) * sizeof(replay_thread));
+    replay_thread *thread = &(*threads)[(*count)++];
+    memset(thread, 0, sizeof(*thread));
+    thread->tid = tid;
+    return thread;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t pool_size = 0;
+    mem_config config = {.backend = MEM_BACKEND_LIST};
+    int opt;
+    while ((opt = getopt(argc, argv, "gtp:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'g':
+            use_libc = true;
+            break;
+        case 't':
+            config.backend = MEM_BACKEND_TLSF;
+            break;
+        case 'p':
+            pool_size = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            optind = argc;
+        }
+    }
+    if (optind >= argc)
+    {
+        printf("Usage: %s [-g | -t] [-p pool_size] <trace file>\n", argv[0]);
+        printf("  -g  replay against glibc malloc instead of the memory manager\n");
+        printf("  -t  use the TLSF backend of the memory manager\n");
+        printf("  -p  pool size for mem_init, default twice the peak live bytes of the trace\n");
+        return 1;
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (!file)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    cm2_trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CM2_TRACE_MAGIC || header.record_size < sizeof(cm2_record))
+    {
+        fprintf(stderr, "%s: not a cM2 trace\n", argv[optind]);
+        fclose(file);
+        return 1;
+    }
+
+    // Load the heap operations; mmap and munmap are not replayed
+    size_t count = 0, capacity = 1024;
+    indexed_record *records = malloc(capacity * sizeof(*records));
+    char *raw = malloc(header.record_size);
+    while (fread(raw, header.record_size, 1, file) == 1)
+    {
+        cm2_record *record = (cm2_record *)raw;
+        if (record->op == CM2_OP_MMAP || record->op == CM2_OP_MUNMAP || (record->op == CM2_OP_FREE && !record->ptr))
+            continue;
+        if (count == capacity)
+        {
+            capacity *= 2;
+            records = realloc(records, capacity * sizeof(*records));
+        }
+        memcpy(&records[count].record, raw, sizeof(cm2_record));
+        records[count].index = count;
+        count++;
+    }
+    fclose(file);
+    free(raw);
+    qsort(records, count, sizeof(*records), compare_records);
+
+    // Link every free and realloc to the event that produced its block, in global trace order
+    events = calloc(count, sizeof(replay_event));
+    blocks = calloc(count, sizeof(void *));
+    ready = calloc(count, sizeof(int));
+    address_map live;
+    map_init(&live, count);
+    replay_thread *threads = NULL;
+    size_t thread_count = 0, skipped = 0, inconsistencies = 0, trace_live = 0, trace_peak = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        cm2_record *record = &records[i].record;
+        replay_event *event = &events[i];
+        event->op = record->op;
+        event->size = record->size;
+        event->alignment = record->op == CM2_OP_MEMALIGN ? record->ptr : 0;
+        event->dep = NO_SLOT;
+        event->stale = NO_SLOT;
+        if (record->op == CM2_OP_FREE || (record->op == CM2_OP_REALLOC && record->ptr))
+        {
+            event->dep = map_take(&live, record->ptr);
+            if (event->dep != NO_SLOT)
+            {
+                events[event->dep].produces = true;
+                trace_live -= events[event->dep].size;
+            }
+            else if (record->op == CM2_OP_FREE)
+                skipped++; // Allocated before the trace started
+        }
+        if (record->op != CM2_OP_FREE && record->result)
+        {
+            event->stale = map_put(&live, record->result, i);
+            if (event->stale != NO_SLOT)
+            {
+                // Two allocations of one address without a free in between: the
+                // free was recorded out of order, or lost
+                events[event->stale].produces = true;
+                trace_live -= events[event->stale].size;
+                inconsistencies++;
+            }
+            trace_live += record->size;
+            if (trace_live > trace_peak)
+                trace_peak = trace_live;
+        }
+
+        replay_thread *thread = thread_for(&threads, &thread_count, record->tid);
+        if (thread->count == thread->capacity)
+        {
+            thread->capacity = thread->capacity ? thread->capacity * 2 : 1024;
+            thread->events = realloc(thread->events, thread->capacity * sizeof(size_t));
+        }
+        thread->events[thread->count++] = i;
+    }
+    free(records);
+
+    if (!use_libc)
+    {
+        if (!pool_size)
+            pool_size = trace_peak * 2 > 1 << 20 ? trace_peak * 2 : 1 << 20;
+        if (mem_init_config(pool_size, &config) != 0)
+        {
+            perror("mem_init_config");
+            return 1;
+        }
+    }
+
+    printf("Replaying %zu events from %zu threads against %s", count, thread_count,
+           use_libc ? "glibc malloc" : config.backend == MEM_BACKEND_TLSF ? "the TLSF backend" : "the memory manager");
+    if (!use_libc)
+        printf(" (pool: %zu bytes)", pool_size);
+    printf("\n");
+
+    struct timeval start_time, end_time;
+    my_barrier_init(&barrier, thread_count + 1);
+    for (size_t i = 0; i < thread_count; i++)
+        pthread_create(&threads[i].thread, NULL, replay_thread_function, &threads[i]);
+    gettimeofday(&start_time, NULL);
+    my_barrier_wait(&barrier);
+    for (size_t i = 0; i < thread_count; i++)
+        pthread_join(threads[i].thread, NULL);
+    gettimeofday(&end_time, NULL);
+
+    double seconds = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1e6;
+    printf("  elapsed:             %.6f s\n", seconds);
+    printf("  throughput:          %.0f ops/s\n", seconds > 0 ? count / seconds : 0.0);
+    printf("  peak live bytes:     %zu (trace: %zu)\n", peak_bytes, trace_peak);
+    if (!use_libc)
+        printf("  peak pool usage:     %zu bytes (%.1f%% of the pool)\n", pool_high_water, 100.0 * pool_high_water / pool_size);
+    printf("  allocation failures: %zu\n", failures);
+    printf("  skipped frees:       %zu (blocks allocated before the trace started)\n", skipped);
+    printf("  inconsistencies:     %zu (addresses allocated again before their free, the older block was freed)\n", inconsistencies);
+
+    if (!use_libc)
+        mem_deinit();
+    my_barrier_destroy(&barrier);
+    for (size_t i = 0; i < thread_count; i++)
+        free(threads[i].events);
+    free(threads);
+    free(live.keys);
+    free(live.values);
+    free(events);
+    free(blocks);
+    free(ready);
+    return failures ? 2 : 0;
+}
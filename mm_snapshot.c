@@ -0,0 +1,326 @@
+#define _GNU_SOURCE
+#include "memory_manager.h"
+#include "mm_internal.h"
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define MM_SNAP_MAGIC 0x50414e534d4d0001ULL // "\1\0MMSNAP"
+#define MM_SNAP_FULL 0
+#define MM_SNAP_INCREMENTAL 1
+#define MM_SNAP_IOV 64 // Runs gathered into one writev call
+
+// Header at the start of every snapshot file
+typedef struct mm_snapshot_header {
+    uint64_t magic;        // MM_SNAP_MAGIC
+    uint32_t kind;         // MM_SNAP_FULL or MM_SNAP_INCREMENTAL
+    uint32_t page_size;    // Granularity of the runs in an incremental snapshot
+    uint64_t geometry_sum; // Geometry of the pool the snapshot was taken from
+    uint64_t generation;   // snapshot_gen of the pool in the snapshot
+    uint64_t image_size;   // Committed bytes of the pool mapping at snapshot time
+    uint64_t run_count;    // Incremental snapshots: number of runs that follow
+} mm_snapshot_header;
+
+// A range of dirty bytes in an incremental snapshot, followed by its data
+typedef struct mm_snapshot_run {
+    uint64_t offset; // Offset from the start of the pool mapping
+    uint64_t length; // Bytes of data following this record
+} mm_snapshot_run;
+
+static int tracking_;              // Set while writes to the pool are being tracked
+static size_t tracked_size_;       // Committed bytes of the mapping when tracking was armed
+static unsigned char *dirty_;      // One bit per page of the mapping, set on the first write
+static size_t dirty_size_;         // Length of the dirty_ mapping
+static struct sigaction old_segv_; // Handler to fall back to for faults outside the pool
+static int handler_installed_;
+
+// Write fault on a protected pool page: note the page as dirty and let the write through
+static void snapshot_fault(int sig, siginfo_t *info, void *context) {
+    char *addr = info->si_addr;
+    char *base = (char *)header_;
+    if (tracking_ && base && addr >= base && addr < base + tracked_size_) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t index = (addr - base) / page;
+        __atomic_or_fetch(&dirty_[index / 8], 1 << (index % 8), __ATOMIC_RELAXED);
+        mprotect(base + index * page, page, PROT_READ | PROT_WRITE);
+        return;
+    }
+
+    // Not ours, hand the fault to whoever handled it before
+    if (old_segv_.sa_flags & SA_SIGINFO) {
+        old_segv_.sa_sigaction(sig, info, context);
+    } else if (old_segv_.sa_handler != SIG_DFL && old_segv_.sa_handler != SIG_IGN) {
+        old_segv_.sa_handler(sig);
+    } else {
+        sigaction(SIGSEGV, &old_segv_, NULL); // The faulting access repeats and takes the default action
+    }
+}
+
+// Pages at the start of the mapping holding the header and the pool lock. They
+// stay writable, so the lock works from any context, and count as always dirty.
+static size_t header_pages() {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return page_round(sizeof(mm_header)) / page;
+}
+
+// Write-protects the committed mapping past the header so that the next write
+// to each page is recorded, lock held
+static int snapshot_track() {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t committed = committed_size(header_, header_->node_commit);
+    size_t skip = header_pages() * page;
+    size_t needed = page_round((map_size_ / page + 7) / 8);
+
+    if (!dirty_ || dirty_size_ < needed) {
+        if (dirty_) munmap(dirty_, dirty_size_);
+        dirty_ = mmap(NULL, needed, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (dirty_ == MAP_FAILED) {
+            dirty_ = NULL;
+            return -1;
+        }
+        dirty_size_ = needed;
+    } else {
+        memset(dirty_, 0, (committed / page + 7) / 8);
+    }
+
+    if (!handler_installed_) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = snapshot_fault;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGSEGV, &action, &old_segv_) != 0) return -1;
+        handler_installed_ = 1;
+    }
+
+    tracked_size_ = committed;
+    tracking_ = 1;
+    if (committed > skip && mprotect((char *)header_ + skip, committed - skip, PROT_READ) != 0) {
+        tracking_ = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void snapshot_untrack() {
+    if (tracking_ && header_) mprotect(header_, tracked_size_, PROT_READ | PROT_WRITE);
+    tracking_ = 0;
+    if (handler_installed_) {
+        // Put the earlier handler back unless someone replaced ours meanwhile
+        struct sigaction current;
+        if (sigaction(SIGSEGV, NULL, &current) == 0 && (current.sa_flags & SA_SIGINFO) && current.sa_sigaction == snapshot_fault)
+            sigaction(SIGSEGV, &old_segv_, NULL);
+        handler_installed_ = 0;
+    }
+    if (dirty_) {
+        munmap(dirty_, dirty_size_);
+        dirty_ = NULL;
+        dirty_size_ = 0;
+    }
+}
+
+// Writes the whole iovec array, continuing after short writes
+static int writev_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// Writes the header and the committed mapping as one sequential stream, lock held
+static int snapshot_full(int fd, mm_snapshot_header *snap) {
+    snap->kind = MM_SNAP_FULL;
+    snap->run_count = 0;
+    struct iovec iov[2] = {{snap, sizeof(*snap)}, {header_, snap->image_size}};
+    return writev_all(fd, iov, 2);
+}
+
+// Writes the pages dirtied since tracking was armed as runs of consecutive pages, lock held
+static int snapshot_dirty(int fd, mm_snapshot_header *snap) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = snap->image_size / page;
+    size_t tracked_pages = tracked_size_ / page;
+    for (size_t index = 0; index < header_pages(); index++) // Never protected, and the header carries the new generation
+        dirty_[index / 8] |= 1 << (index % 8);
+
+    // Pages committed after tracking was armed were never protected and count as dirty
+    mm_snapshot_run runs[MM_SNAP_IOV / 2];
+    struct iovec iov[MM_SNAP_IOV];
+    int pass;
+    snap->kind = MM_SNAP_INCREMENTAL;
+    snap->run_count = 0;
+    for (pass = 0; pass < 2; pass++) {
+        // First pass counts the runs for the header, second pass writes them
+        int used = 0;
+        if (pass == 1) {
+            struct iovec head = {snap, sizeof(*snap)};
+            if (writev_all(fd, &head, 1) != 0) return -1;
+        }
+        size_t index = 0;
+        while (index < pages) {
+            int dirty = index >= tracked_pages || (dirty_[index / 8] & (1 << (index % 8)));
+            if (!dirty) {
+                index++;
+                continue;
+            }
+            size_t first = index;
+            while (index < pages && (index >= tracked_pages || (dirty_[index / 8] & (1 << (index % 8))))) index++;
+
+            if (pass == 0) {
+                snap->run_count++;
+                continue;
+            }
+            mm_snapshot_run *run = &runs[used / 2];
+            run->offset = first * page;
+            run->length = (index - first) * page;
+            iov[used++] = (struct iovec){run, sizeof(*run)};
+            iov[used++] = (struct iovec){(char *)header_ + run->offset, run->length};
+            if (used == MM_SNAP_IOV) {
+                if (writev_all(fd, iov, used) != 0) return -1;
+                used = 0;
+            }
+        }
+        if (pass == 1 && used > 0 && writev_all(fd, iov, used) != 0) return -1;
+    }
+    return 0;
+}
+
+// Shared by mem_snapshot and mem_snapshot_incremental
+static int snapshot_core(int fd, int incremental) {
+    if (!header_) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock_pool();
+    header_->snapshot_gen++;
+
+    mm_snapshot_header snap = {
+        .magic = MM_SNAP_MAGIC,
+        .page_size = (uint32_t)sysconf(_SC_PAGESIZE),
+        .geometry_sum = header_->geometry_sum,
+        .generation = header_->snapshot_gen,
+        .image_size = committed_size(header_, header_->node_commit),
+    };
+    // Without a tracked baseline every page may have changed, so fall back to a full image
+    int result = (incremental && tracking_) ? snapshot_dirty(fd, &snap) : snapshot_full(fd, &snap);
+    if (result == 0) result = snapshot_track();
+    pthread_mutex_unlock(allocation_lock);
+    return result;
+}
+
+int mem_snapshot(int fd) {
+    return snapshot_core(fd, 0);
+}
+
+int mem_snapshot_incremental(int fd) {
+    return snapshot_core(fd, 1);
+}
+
+void mem_snapshot_stop(void) {
+    if (!header_) return;
+    lock_pool();
+    snapshot_untrack();
+    pthread_mutex_unlock(allocation_lock);
+}
+
+// Copies @p length bytes of a snapshot to @p offset in the mapping, keeping this pool's lock
+static void restore_range(size_t offset, const char *data, size_t length) {
+    char *base = (char *)header_;
+    size_t lock_start = offsetof(mm_header, lock);
+    size_t lock_end = lock_start + sizeof(pthread_mutex_t);
+    if (offset < lock_end && offset + length > lock_start) {
+        // The lock is held by this call and has to survive the copy
+        if (offset < lock_start) memcpy(base + offset, data, lock_start - offset);
+        if (offset + length > lock_end) memcpy(base + lock_end, data + (lock_end - offset), offset + length - lock_end);
+        return;
+    }
+    memcpy(base + offset, data, length);
+}
+
+// Whether an image of @p image_size bytes with @p node_commit nodes fits the
+// mapping and what restoring it commits
+static int image_fits(uint64_t image_size, uint64_t node_commit) {
+    return node_commit <= header_->node_reserve && image_size <= map_size_ && image_size <= committed_size(header_, node_commit);
+}
+
+int mem_restore(int fd) {
+    struct stat st;
+    if (!header_ || fstat(fd, &st) != 0) {
+        if (!header_) errno = EINVAL;
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(mm_snapshot_header)) {
+        errno = EINVAL;
+        return -1;
+    }
+    const char *image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) return -1;
+    const mm_snapshot_header *snap = (const mm_snapshot_header *)image;
+    const mm_header *saved = (const mm_header *)(image + sizeof(*snap));
+    size_t available = st.st_size - sizeof(*snap);
+
+    lock_pool();
+    int result = -1;
+    errno = EINVAL;
+    if (snap->magic != MM_SNAP_MAGIC || snap->geometry_sum != header_->geometry_sum) goto out;
+    // An incremental snapshot only applies to the state the previous snapshot left behind
+    if (snap->kind == MM_SNAP_INCREMENTAL && snap->generation != header_->snapshot_gen + 1) goto out;
+
+    if (snap->kind == MM_SNAP_FULL) {
+        if (available < snap->image_size || snap->image_size < sizeof(mm_header)) goto out;
+        if (!image_fits(snap->image_size, saved->node_commit)) goto out;
+        if (commit_nodes(saved->node_commit) != 0) goto out;
+        restore_range(0, (const char *)saved, snap->image_size);
+    } else {
+        // Validate every run before touching the pool
+        const char *cursor = image + sizeof(*snap);
+        const char *limit = image + st.st_size;
+        for (uint64_t i = 0; i < snap->run_count; i++) {
+            const mm_snapshot_run *run = (const mm_snapshot_run *)cursor;
+            if (cursor + sizeof(*run) > limit || run->length > (uint64_t)(limit - cursor - sizeof(*run))) goto out;
+            // Inside the image, written so that offset + length cannot wrap
+            if (run->offset > snap->image_size || run->length > snap->image_size - run->offset) goto out;
+            cursor += sizeof(*run) + run->length;
+        }
+        const mm_snapshot_run *first = (const mm_snapshot_run *)(image + sizeof(*snap));
+        if (snap->run_count == 0 || first->offset != 0 || first->length < sizeof(mm_header)) goto out;
+
+        const mm_header *new_header = (const mm_header *)(image + sizeof(*snap) + sizeof(mm_snapshot_run));
+        if (!image_fits(snap->image_size, new_header->node_commit)) goto out;
+        if (commit_nodes(new_header->node_commit) != 0) goto out;
+        cursor = image + sizeof(*snap);
+        for (uint64_t i = 0; i < snap->run_count; i++) {
+            const mm_snapshot_run *run = (const mm_snapshot_run *)cursor;
+            restore_range(run->offset, cursor + sizeof(*run), run->length);
+            cursor += sizeof(*run) + run->length;
+        }
+    }
+    // The pool no longer matches what was last written, the next incremental snapshot has to be a full one
+    if (tracking_) mprotect(header_, tracked_size_, PROT_READ | PROT_WRITE);
+    tracking_ = 0;
+    result = 0;
+
+out:
+    pthread_mutex_unlock(allocation_lock);
+    munmap((void *)image, st.st_size);
+    return result;
+}
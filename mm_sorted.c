@@ -0,0 +1,169 @@
+// mm_sorted.c
+// Block metadata as sorted arrays: binary search instead of walking a chain
+#include "memory_manager.h"
+#include "mm_internal.h"
+#include <stdint.h>
+#include <string.h>
+
+// The committed node table holds two arrays of node_commit entries each: the
+// start offsets of all blocks in ascending order, followed by their sizes.
+// Entry i of both describes one block and node_used counts the entries. The
+// tags of the blocks follow as 32-bit values, in the room a node has left.
+// Searches read only the start array, sequentially or by bisection, so a walk
+// touches a few contiguous cache lines instead of one node per block, and
+// inserting or removing shifts the tail of both arrays with memmove.
+
+static uint64_t *starts() {
+    return (uint64_t *)nodes_;
+}
+
+static uint64_t *sizes() {
+    return (uint64_t *)nodes_ + header_->node_commit;
+}
+
+_Static_assert(sizeof(memory_block) >= 2 * sizeof(uint64_t) + sizeof(uint32_t), "a node holds an entry of every array");
+
+static uint32_t *tags() {
+    return (uint32_t *)(sizes() + header_->node_commit);
+}
+
+// Index of the first block starting at or after @p offset
+static uint64_t lower_bound(uint64_t offset) {
+    uint64_t *start = starts();
+    uint64_t low = 0, high = header_->node_used;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        if (start[mid] < offset) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Index of the block starting exactly at @p offset, or node_used if there is none
+static uint64_t find(uint64_t offset) {
+    uint64_t i = lower_bound(offset);
+    return i < header_->node_used && starts()[i] == offset ? i : header_->node_used;
+}
+
+// Doubles the arrays' capacity; the size and tag arrays move up behind the longer start array
+static int grow() {
+    uint64_t old_commit = header_->node_commit;
+    uint64_t commit = old_commit * 2 > header_->node_reserve ? header_->node_reserve : old_commit * 2;
+    if (commit == old_commit || commit_nodes(commit) != 0) return -1;
+    uint64_t *start = starts();
+    // Tags first, the sizes move into where they were
+    memmove(start + 2 * commit, start + 2 * old_commit, header_->node_used * sizeof(uint32_t));
+    memmove(start + commit, start + old_commit, header_->node_used * sizeof(uint64_t));
+    return 0;
+}
+
+// Inserts a block at index @p i, keeping both arrays sorted
+static int insert(uint64_t i, uint64_t start, uint64_t size, unsigned tag) {
+    if (header_->node_used == header_->node_commit && grow() != 0) return -1;
+    uint64_t *start_array = starts(), *size_array = sizes();
+    uint32_t *tag_array = tags();
+    uint64_t tail = header_->node_used - i;
+    memmove(start_array + i + 1, start_array + i, tail * sizeof(uint64_t));
+    memmove(size_array + i + 1, size_array + i, tail * sizeof(uint64_t));
+    memmove(tag_array + i + 1, tag_array + i, tail * sizeof(uint32_t));
+    start_array[i] = start;
+    size_array[i] = size;
+    tag_array[i] = tag;
+    header_->node_used++;
+    return 0;
+}
+
+static void erase(uint64_t i) {
+    uint64_t *start_array = starts(), *size_array = sizes();
+    uint32_t *tag_array = tags();
+    uint64_t tail = header_->node_used - i - 1;
+    memmove(start_array + i, start_array + i + 1, tail * sizeof(uint64_t));
+    memmove(size_array + i, size_array + i + 1, tail * sizeof(uint64_t));
+    memmove(tag_array + i, tag_array + i + 1, tail * sizeof(uint32_t));
+    header_->node_used--;
+}
+
+void *sorted_alloc(size_t size, size_t alignment, unsigned tag) {
+    uint64_t from = 0;
+    return sorted_alloc_from(&from, size, alignment, tag);
+}
+
+void *sorted_alloc_from(uint64_t *from, size_t size, size_t alignment, unsigned tag) {
+    // First fit in address order, like the block list
+    uint64_t *start_array = starts(), *size_array = sizes();
+    uint64_t used = header_->node_used;
+    uint64_t gap_start = *from ? start_array[*from - 1] + size_array[*from - 1] : 0;
+    for (uint64_t i = *from; i <= used; i++) {
+        uint64_t limit = i < used ? start_array[i] : size_;
+        uint64_t start = gap_start;
+        if (alignment > 1) start += (alignment - ((uintptr_t)memory_ + gap_start) % alignment) % alignment;
+        if (start <= limit && limit - start >= size) {
+            if (insert(i, start, size, tag) != 0) return NULL;
+            *from = i + 1;
+            return memory_ + start;
+        }
+        if (i < used) gap_start = start_array[i] + size_array[i];
+    }
+    return NULL;
+}
+
+void sorted_free(void *ptr) {
+    uint64_t i = find((uint64_t)((char *)ptr - memory_));
+    if (i < header_->node_used) erase(i);
+}
+
+void *sorted_resize(void *ptr, size_t size) {
+    uint64_t offset = (uint64_t)((char *)ptr - memory_);
+    uint64_t i = find(offset);
+    if (i == header_->node_used) return NULL;
+
+    // Grow or shrink in place when the gap up to the next block allows it
+    uint64_t limit = i + 1 < header_->node_used ? starts()[i + 1] : size_;
+    if (limit - offset >= size) {
+        sizes()[i] = size;
+        return ptr;
+    }
+
+    // Move it, the old range counts as free while searching
+    uint64_t old_size = sizes()[i];
+    unsigned tag = tags()[i];
+    erase(i);
+    void *moved = sorted_alloc(size, 1, tag);
+    if (!moved) {
+        insert(i, offset, old_size, tag); // Cannot fail, the entry was just removed
+        return NULL;
+    }
+    memmove(moved, ptr, old_size);
+    return moved;
+}
+
+size_t sorted_block_size(const void *ptr, unsigned *tag) {
+    uint64_t i = find((uint64_t)((const char *)ptr - memory_));
+    if (i == header_->node_used) return 0;
+    *tag = tags()[i];
+    return sizes()[i];
+}
+
+void sorted_free_ranges(mm_range_fn fn, void *arg) {
+    uint64_t *start_array = starts(), *size_array = sizes();
+    uint64_t gap_start = 0;
+    for (uint64_t i = 0; i <= header_->node_used; i++) {
+        uint64_t limit = i < header_->node_used ? start_array[i] : size_;
+        if (limit > gap_start && fn(gap_start, limit, arg)) return;
+        if (i < header_->node_used) gap_start = start_array[i] + size_array[i];
+    }
+}
+
+int sorted_check() {
+    if (header_->node_used > header_->node_commit) return -1;
+    uint64_t *start_array = starts(), *size_array = sizes();
+    uint32_t *tag_array = tags();
+    uint64_t last_end = 0;
+    for (uint64_t i = 0; i < header_->node_used; i++) {
+        if (start_array[i] < last_end || start_array[i] > size_ || size_array[i] == 0 || size_array[i] > size_ - start_array[i] ||
+            tag_array[i] >= MEM_TAG_COUNT)
+            return -1;
+        last_end = start_array[i] + size_array[i];
+    }
+    return 0;
+}
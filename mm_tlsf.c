@@ -0,0 +1,350 @@
+// mm_tlsf.c
+// Two-level segregated fit backend: allocation and free in constant time
+#include "memory_manager.h"
+#include "mm_internal.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Free blocks are kept in lists segregated by size. The first level splits the
+// sizes by powers of two, the second splits every power of two into
+// TLSF_SL_COUNT equal ranges. A bitmap per level finds the smallest non-empty
+// list that can serve a request with two find-first-set instructions, so no
+// operation ever walks a list. Freed blocks merge with free neighbors at once.
+#define TLSF_ALIGN_LOG2 4
+#define TLSF_ALIGN (1UL << TLSF_ALIGN_LOG2) // Alignment of every payload and payload size
+#define TLSF_SL_LOG2 5
+#define TLSF_SL_COUNT (1U << TLSF_SL_LOG2)  // Second-level lists per power of two
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + TLSF_ALIGN_LOG2)
+#define TLSF_FL_MAX 47                      // Blocks stay below 2^48 bytes
+#define TLSF_FL_COUNT (TLSF_FL_MAX - TLSF_FL_SHIFT + 2)
+#define TLSF_SMALL (1UL << TLSF_FL_SHIFT)   // Sizes below this share first-level list 0
+#define TLSF_NONE UINT64_MAX                // Ends free lists and marks the first block
+
+#define TLSF_FREE 1UL      // Size flag: the block is free
+#define TLSF_PREV_FREE 2UL // Size flag: the block before it in address order is free
+#define TLSF_TAG_SHIFT 48  // Used blocks keep their allocation tag above the size
+#define TLSF_TAG_MASK (~0UL << TLSF_TAG_SHIFT)
+
+// Header in front of every block in the pool. Links are pool offsets, like
+// the node table of the list backend, so the pool stays position independent.
+typedef struct tlsf_block {
+    uint64_t prev_phys; // Offset of the block before this one in address order
+    uint64_t size;      // Payload bytes, the low bits hold the flags above and the high bits the tag
+    uint64_t next_free; // Free list links, stored in the payload of free blocks only
+    uint64_t prev_free;
+} tlsf_block;
+
+#define TLSF_HEADER offsetof(tlsf_block, next_free) // Bytes in front of every payload
+#define TLSF_MIN_BLOCK sizeof(tlsf_block)           // Smallest block including its header
+
+// Free list heads and bitmaps, stored right after mm_header
+typedef struct tlsf_control {
+    uint64_t fl_bitmap;                           // Bit per first-level range with a free block
+    uint32_t sl_bitmap[TLSF_FL_COUNT];            // Bit per non-empty second-level list
+    uint64_t heads[TLSF_FL_COUNT][TLSF_SL_COUNT]; // First block of every free list
+} tlsf_control;
+
+#define TLSF_CONTROL_OFFSET ((sizeof(mm_header) + 63) & ~(size_t)63)
+
+static tlsf_control *control() {
+    return (tlsf_control *)((char *)header_ + TLSF_CONTROL_OFFSET);
+}
+
+static tlsf_block *block_at(uint64_t offset) {
+    return (tlsf_block *)(memory_ + offset);
+}
+
+static uint64_t block_size(const tlsf_block *block) {
+    return block->size & ~TLSF_TAG_MASK & ~(TLSF_ALIGN - 1);
+}
+
+static void set_size(tlsf_block *block, uint64_t size) {
+    block->size = size | (block->size & (TLSF_TAG_MASK | TLSF_FREE | TLSF_PREV_FREE));
+}
+
+static uint64_t next_phys(uint64_t offset) {
+    return offset + TLSF_HEADER + block_size(block_at(offset));
+}
+
+// Offset of the zero-sized block that ends the pool and is never free
+static uint64_t sentinel() {
+    return (size_ & ~(TLSF_ALIGN - 1)) - TLSF_HEADER;
+}
+
+// Payload size serving a request of @p size bytes, 0 if it can never fit
+static uint64_t adjust_size(size_t size) {
+    if (size > (1UL << TLSF_FL_MAX)) return 0;
+    uint64_t adjusted = (size + TLSF_ALIGN - 1) & ~(TLSF_ALIGN - 1);
+    return adjusted < TLSF_MIN_BLOCK - TLSF_HEADER ? TLSF_MIN_BLOCK - TLSF_HEADER : adjusted;
+}
+
+// List a free block of @p size bytes belongs to
+static void mapping_insert(uint64_t size, unsigned *fl, unsigned *sl) {
+    if (size < TLSF_SMALL) {
+        *fl = 0;
+        *sl = (unsigned)(size / (TLSF_SMALL / TLSF_SL_COUNT));
+    } else {
+        unsigned bit = 63 - __builtin_clzll(size);
+        *sl = (unsigned)(size >> (bit - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+        *fl = bit - TLSF_FL_SHIFT + 1;
+    }
+}
+
+// First list whose blocks are all at least @p size bytes
+static void mapping_search(uint64_t size, unsigned *fl, unsigned *sl) {
+    if (size >= TLSF_SMALL) size += (1UL << (63 - __builtin_clzll(size) - TLSF_SL_LOG2)) - 1;
+    mapping_insert(size, fl, sl);
+}
+
+static void insert_free(uint64_t offset) {
+    tlsf_control *ctl = control();
+    tlsf_block *block = block_at(offset);
+    unsigned fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    uint64_t head = ctl->heads[fl][sl];
+    block->next_free = head;
+    block->prev_free = TLSF_NONE;
+    if (head != TLSF_NONE) block_at(head)->prev_free = offset;
+    ctl->heads[fl][sl] = offset;
+    ctl->fl_bitmap |= 1ULL << fl;
+    ctl->sl_bitmap[fl] |= 1U << sl;
+}
+
+static void remove_free(uint64_t offset) {
+    tlsf_control *ctl = control();
+    tlsf_block *block = block_at(offset);
+    unsigned fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    if (block->next_free != TLSF_NONE) block_at(block->next_free)->prev_free = block->prev_free;
+    if (block->prev_free != TLSF_NONE) {
+        block_at(block->prev_free)->next_free = block->next_free;
+    } else {
+        ctl->heads[fl][sl] = block->next_free;
+        if (block->next_free == TLSF_NONE) { // List emptied, clear its bits
+            ctl->sl_bitmap[fl] &= ~(1U << sl);
+            if (!ctl->sl_bitmap[fl]) ctl->fl_bitmap &= ~(1ULL << fl);
+        }
+    }
+}
+
+// Finds a free block of at least @p size bytes without searching any list
+static uint64_t find_free(uint64_t size) {
+    tlsf_control *ctl = control();
+    unsigned fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= TLSF_FL_COUNT) return TLSF_NONE;
+    uint32_t sl_map = ctl->sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map) {
+        uint64_t fl_map = ctl->fl_bitmap & (~0ULL << (fl + 1));
+        if (!fl_map) {
+            // Rounding up skipped the request's own list; its head may still be large enough
+            mapping_insert(size, &fl, &sl);
+            uint64_t head = ctl->heads[fl][sl];
+            return head != TLSF_NONE && block_size(block_at(head)) >= size ? head : TLSF_NONE;
+        }
+        fl = __builtin_ctzll(fl_map);
+        sl_map = ctl->sl_bitmap[fl];
+    }
+    return ctl->heads[fl][__builtin_ctz(sl_map)];
+}
+
+// Marks the block at @p offset used and clears the flag its successor keeps about it
+static void mark_used(uint64_t offset) {
+    block_at(offset)->size &= ~TLSF_FREE;
+    block_at(next_phys(offset))->size &= ~TLSF_PREV_FREE;
+}
+
+// Frees the block at @p offset, merging it with free neighbors
+static void release(uint64_t offset) {
+    tlsf_block *block = block_at(offset);
+    block->size = (block->size & ~TLSF_TAG_MASK) | TLSF_FREE; // Stays marked if it merges into its predecessor
+    if (block->size & TLSF_PREV_FREE) {
+        uint64_t prev = block->prev_phys;
+        remove_free(prev);
+        set_size(block_at(prev), block_size(block_at(prev)) + TLSF_HEADER + block_size(block));
+        offset = prev;
+        block = block_at(prev);
+    }
+    uint64_t next = next_phys(offset);
+    if (block_at(next)->size & TLSF_FREE) {
+        remove_free(next);
+        set_size(block, block_size(block) + TLSF_HEADER + block_size(block_at(next)));
+        next = next_phys(offset);
+    }
+    block->size |= TLSF_FREE;
+    block_at(next)->prev_phys = offset;
+    block_at(next)->size |= TLSF_PREV_FREE;
+    insert_free(offset);
+}
+
+// Trims the used block at @p offset to @p size bytes, the rest becomes a free block
+static void split(uint64_t offset, uint64_t size) {
+    tlsf_block *block = block_at(offset);
+    uint64_t total = block_size(block);
+    if (total - size < TLSF_MIN_BLOCK) return; // Too little left over to hold a block
+    uint64_t rest = offset + TLSF_HEADER + size;
+    set_size(block, size);
+    block_at(rest)->prev_phys = offset;
+    block_at(rest)->size = total - size - TLSF_HEADER;
+    block_at(next_phys(rest))->prev_phys = rest;
+    release(rest);
+}
+
+size_t tlsf_metadata_end() {
+    return TLSF_CONTROL_OFFSET + sizeof(tlsf_control);
+}
+
+int tlsf_pool_valid(size_t size) {
+    return size >= TLSF_MIN_BLOCK + 2 * TLSF_HEADER && size - TLSF_HEADER <= (1UL << (TLSF_FL_MAX + 1));
+}
+
+void tlsf_init() {
+    tlsf_control *ctl = control();
+    memset(ctl, 0, sizeof(*ctl));
+    memset(ctl->heads, 0xff, sizeof(ctl->heads)); // TLSF_NONE
+    // One free block spanning the pool, followed by the sentinel
+    uint64_t end = sentinel();
+    block_at(0)->prev_phys = TLSF_NONE;
+    block_at(0)->size = end - TLSF_HEADER;
+    block_at(end)->prev_phys = 0;
+    block_at(end)->size = 0;
+    release(0);
+}
+
+void *tlsf_alloc(size_t size, size_t alignment, unsigned tag) {
+    uint64_t payload = adjust_size(size);
+    if (!payload) return NULL;
+    // Over-aligned requests take enough extra to cut a free block off the front
+    uint64_t gap = alignment > TLSF_ALIGN ? alignment + TLSF_MIN_BLOCK : 0;
+    uint64_t offset = find_free(payload + gap);
+    if (offset == TLSF_NONE) return NULL;
+    remove_free(offset);
+    mark_used(offset);
+
+    if (gap) {
+        uintptr_t address = (uintptr_t)memory_ + offset + TLSF_HEADER;
+        uintptr_t aligned = (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (aligned != address) {
+            if (aligned - address < TLSF_MIN_BLOCK) aligned = (address + TLSF_MIN_BLOCK + alignment - 1) & ~(uintptr_t)(alignment - 1);
+            uint64_t moved = aligned - (uintptr_t)memory_ - TLSF_HEADER;
+            tlsf_block *front = block_at(offset);
+            block_at(moved)->prev_phys = offset;
+            block_at(moved)->size = block_size(front) - (moved - offset);
+            block_at(next_phys(moved))->prev_phys = moved;
+            set_size(front, moved - offset - TLSF_HEADER);
+            release(offset); // The block before was used, so the front stays a block of its own
+            offset = moved;
+        }
+    }
+    split(offset, payload);
+    block_at(offset)->size |= (uint64_t)tag << TLSF_TAG_SHIFT;
+    return memory_ + offset + TLSF_HEADER;
+}
+
+// Offset of the header of @p ptr, TLSF_NONE if it cannot be a used block. A
+// pointer into a payload or to a block merged away has no neighbors linking to
+// it, so both physical links are checked, not just the flag.
+static uint64_t block_of(const void *ptr) {
+    uint64_t offset = (uint64_t)((const char *)ptr - memory_) - TLSF_HEADER;
+    uint64_t end = sentinel();
+    if ((const char *)ptr < memory_ + TLSF_HEADER || offset >= end || offset % TLSF_ALIGN) return TLSF_NONE;
+    tlsf_block *block = block_at(offset);
+    if (block->size & TLSF_FREE) return TLSF_NONE; // Already freed
+    if (block_size(block) > end - offset - TLSF_HEADER || block_at(next_phys(offset))->prev_phys != offset) return TLSF_NONE;
+    uint64_t prev = block->prev_phys;
+    if (prev == TLSF_NONE ? offset != 0 : prev >= offset || prev % TLSF_ALIGN || next_phys(prev) != offset) return TLSF_NONE;
+    return offset;
+}
+
+void tlsf_free(void *ptr) {
+    uint64_t offset = block_of(ptr);
+    if (offset != TLSF_NONE) release(offset);
+}
+
+void *tlsf_resize(void *ptr, size_t size) {
+    uint64_t offset = block_of(ptr);
+    uint64_t payload = adjust_size(size);
+    if (offset == TLSF_NONE || !payload) return NULL;
+    tlsf_block *block = block_at(offset);
+    uint64_t current = block_size(block);
+    if (payload <= current) {
+        split(offset, payload);
+        return ptr;
+    }
+
+    // Grow in place by taking over a free successor
+    uint64_t next = next_phys(offset);
+    if ((block_at(next)->size & TLSF_FREE) && current + TLSF_HEADER + block_size(block_at(next)) >= payload) {
+        remove_free(next);
+        set_size(block, current + TLSF_HEADER + block_size(block_at(next)));
+        next = next_phys(offset);
+        block_at(next)->prev_phys = offset;
+        block_at(next)->size &= ~TLSF_PREV_FREE;
+        split(offset, payload);
+        return ptr;
+    }
+
+    void *moved = tlsf_alloc(size, 1, (unsigned)(block->size >> TLSF_TAG_SHIFT));
+    if (!moved) return NULL; // The old block stays valid
+    memcpy(moved, ptr, current);
+    release(offset);
+    return moved;
+}
+
+size_t tlsf_block_size(const void *ptr, unsigned *tag) {
+    uint64_t offset = block_of(ptr);
+    if (offset == TLSF_NONE) return 0;
+    *tag = (unsigned)(block_at(offset)->size >> TLSF_TAG_SHIFT);
+    return block_size(block_at(offset));
+}
+
+void tlsf_free_ranges(mm_range_fn fn, void *arg) {
+    uint64_t end = sentinel();
+    for (uint64_t offset = 0; offset < end; offset = next_phys(offset)) {
+        tlsf_block *block = block_at(offset);
+        // The free list links at the start of the payload stay in use
+        if ((block->size & TLSF_FREE) && fn(offset + TLSF_MIN_BLOCK, offset + TLSF_HEADER + block_size(block), arg)) return;
+    }
+}
+
+int tlsf_check() {
+    uint64_t end = sentinel();
+    uint64_t prev = TLSF_NONE, free_blocks = 0;
+    int prev_free = 0;
+    uint64_t offset = 0;
+    while (offset < end) {
+        tlsf_block *block = block_at(offset);
+        uint64_t size = block_size(block);
+        if (block->prev_phys != prev || !!(block->size & TLSF_PREV_FREE) != prev_free) return -1;
+        if (size < TLSF_MIN_BLOCK - TLSF_HEADER || size > end - offset - TLSF_HEADER) return -1;
+        int is_free = (block->size & TLSF_FREE) != 0;
+        uint64_t tag = block->size >> TLSF_TAG_SHIFT;
+        if (tag >= MEM_TAG_COUNT || (is_free && tag)) return -1;
+        if (is_free && prev_free) return -1; // Neighbors should have been merged
+        free_blocks += is_free;
+        prev = offset;
+        prev_free = is_free;
+        offset += TLSF_HEADER + size;
+    }
+    if (offset != end || block_at(end)->prev_phys != prev || !!(block_at(end)->size & TLSF_PREV_FREE) != prev_free) return -1;
+
+    // Every free block is on the list its size maps to, and the bitmaps match the lists
+    tlsf_control *ctl = control();
+    uint64_t listed = 0;
+    for (unsigned fl = 0; fl < TLSF_FL_COUNT; fl++) {
+        if (!!(ctl->fl_bitmap & (1ULL << fl)) != (ctl->sl_bitmap[fl] != 0)) return -1;
+        for (unsigned sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            uint64_t at = ctl->heads[fl][sl];
+            if (!!(ctl->sl_bitmap[fl] & (1U << sl)) != (at != TLSF_NONE)) return -1;
+            for (uint64_t before = TLSF_NONE; at != TLSF_NONE; before = at, at = block_at(at)->next_free) {
+                if (at >= end || ++listed > free_blocks) return -1;
+                unsigned list_fl, list_sl;
+                mapping_insert(block_size(block_at(at)), &list_fl, &list_sl);
+                if (!(block_at(at)->size & TLSF_FREE) || block_at(at)->prev_free != before || list_fl != fl || list_sl != sl)
+                    return -1;
+            }
+        }
+    }
+    return listed == free_blocks ? 0 : -1;
+}
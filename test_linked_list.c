@@ -1,16 +1,20 @@
 #include "linked_list.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 #include <time.h>
 #include <stddef.h>
 #include <math.h>
+#include <unistd.h>
 #include "common_defs.h"
 #include "gitdata.h"
 
 typedef struct
 {
     Node **head; // Pointer to the head of the linked list
+    List *list;  // List of its own, for the List tests
+    CompactList *clist;
     Node *prev_node;
     int start_value; // Value of the node to insert after
     int thread_id;   // Unique ID for each thread
@@ -21,6 +25,7 @@ typedef struct
 {
     int num_threads;
     int num_nodes;
+    list_locking locking; // LIST_LOCK_GLOBAL unless set
 } TestParams;
 
 // Function to capture stdout output.
@@ -77,7 +82,7 @@ void test_list_insert_multithread(TestParams *params)
     printf_yellow("  Testing list_insert (threads: %d, nodes: %d) ---> ", params->num_threads, params->num_nodes);
 
     Node *head = NULL;
-    list_init(&head, sizeof(Node) * params->num_nodes);
+    list_init_locking(&head, sizeof(Node) * params->num_nodes, params->locking);
 
     pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
     thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
@@ -125,7 +130,7 @@ void test_list_insert_after_multithread(TestParams *params)
     printf_yellow("  Testing list_insert_after (threads: %d, nodes: %d) ---> ", params->num_threads, params->num_nodes);
 
     Node *head = NULL;
-    list_init(&head, sizeof(Node) * (params->num_nodes + 1)); // +1 for the initial node
+    list_init_locking(&head, sizeof(Node) * (params->num_nodes + 1), params->locking); // +1 for the initial node
     list_insert(&head, 10);                                   // Initial node to insert after
 
     pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
@@ -178,7 +183,7 @@ void test_list_insert_before_multithreaded(TestParams *params)
 {
     printf_yellow("  Testing list_insert_before with %d threads, each inserting %d nodes ---> ", params->num_threads, params->num_nodes);
     Node *head = NULL;
-    list_init(&head, sizeof(Node) * (params->num_threads + params->num_nodes + 1)); // Allocate enough space
+    list_init_locking(&head, sizeof(Node) * (params->num_threads + params->num_nodes + 1), params->locking); // Allocate enough space
 
     Node **nodes = malloc(sizeof(Node *) * (params->num_threads + 1)); // Array of pointers to Node
     list_insert(&head, 0);                                             // Insert the initial head node
@@ -234,7 +239,7 @@ void test_list_delete_multithreaded(TestParams *params)
 {
     printf_yellow("  Testing list_delete with %d threads, nodes: %d ---> ", params->num_threads, params->num_nodes);
     Node *head = NULL;
-    list_init(&head, sizeof(Node) * (params->num_threads * params->num_nodes));
+    list_init_locking(&head, sizeof(Node) * (params->num_threads * params->num_nodes), params->locking);
 
     // Insert nodes into the list
     for (int i = 0; i < params->num_nodes; i++)
@@ -644,6 +649,731 @@ void test_list_edge_cases()
     printf_green("[PASS].\n");
 }
 
+/* Tests that list_insert keeps appending at the end after the last node was deleted or had nodes inserted after it */
+void test_list_tail()
+{
+    printf_yellow("  Testing list_insert after changes to the last node ---> ");
+    Node *head = NULL;
+    list_init(&head, sizeof(Node) * 8);
+
+    list_insert(&head, 1);
+    list_insert(&head, 2);
+    list_insert(&head, 3);
+    list_delete(&head, 3); // Last node
+    list_insert(&head, 4);
+    list_insert_after(list_search(&head, 4), 5);
+    list_insert(&head, 6);
+    list_delete(&head, 1);
+    list_delete(&head, 2);
+    list_delete(&head, 4);
+    list_delete(&head, 5);
+    list_delete(&head, 6); // Empties the list
+    list_insert(&head, 7);
+    list_insert(&head, 8);
+
+    uint16_t expected[] = {7, 8};
+    Node *current = head;
+    for (int i = 0; i < 2; i++)
+    {
+        my_assert(current && current->data == expected[i]);
+        current = current ? current->next : NULL;
+    }
+    my_assert(current == NULL);
+
+    list_cleanup(&head);
+    printf_green("[PASS].\n");
+}
+
+void *thread_insert_after_own_node(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_nodes; i++)
+        list_insert_after(data->prev_node, data->start_value + i);
+    return NULL;
+}
+
+/* Tests list_insert_after with every thread on its own node, which lock coupling lets run in parallel */
+void test_list_insert_after_spread(TestParams *params)
+{
+    printf_yellow("  Testing list_insert_after on separate nodes (%s locking, threads: %d, nodes: %d) ---> ",
+                  params->locking == LIST_LOCK_COUPLING ? "coupled" : "global", params->num_threads, params->num_nodes);
+    Node *head = NULL;
+    int nodes_per_thread = params->num_nodes / params->num_threads;
+    list_init_locking(&head, sizeof(Node) * (params->num_threads + params->num_nodes), params->locking);
+
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
+    Node *anchor = NULL;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        list_insert(&head, 60000 + i);
+        anchor = anchor ? anchor->next : head;
+        thread_data[i].prev_node = anchor;
+        thread_data[i].start_value = i * nodes_per_thread;
+        thread_data[i].num_nodes = nodes_per_thread;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < params->num_threads; i++)
+        pthread_create(&threads[i], NULL, thread_insert_after_own_node, &thread_data[i]);
+    for (int i = 0; i < params->num_threads; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // Every anchor is followed by its thread's values, newest first
+    my_assert(list_count_nodes(&head) == params->num_threads + params->num_threads * nodes_per_thread);
+    Node *walker = head;
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        my_assert(walker->data == 60000 + i);
+        walker = walker->next;
+        for (int k = nodes_per_thread - 1; k >= 0; k--, walker = walker->next)
+            my_assert(walker->data == i * nodes_per_thread + k);
+    }
+    printf("%.2f ms ---> ", ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e6);
+
+    list_cleanup(&head);
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
+void *thread_insert_delete_rounds(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int round = 0; round < 8; round++)
+    {
+        for (int i = 0; i < data->num_nodes; i++)
+            list_insert_after(data->prev_node, data->start_value + i);
+        for (int i = 0; i < data->num_nodes; i++)
+        {
+            my_assert(list_search(data->head, data->start_value + i) != NULL);
+            list_delete(data->head, data->start_value + i);
+        }
+    }
+    return NULL;
+}
+
+/* Tests inserts, searches and deletes running together; the pool holds a fraction of all nodes ever allocated */
+void test_list_mixed_multithread(TestParams *params)
+{
+    printf_yellow("  Testing mixed insert, search and delete (threads: %d, nodes: %d) ---> ", params->num_threads, params->num_nodes);
+    Node *head = NULL;
+    int nodes_per_thread = params->num_nodes / params->num_threads;
+    list_init_locking(&head, sizeof(Node) * (4 * params->num_nodes + 1), params->locking); // Room for nodes waiting to be reclaimed
+    list_insert(&head, 65535);
+
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        thread_data[i].head = &head;
+        thread_data[i].prev_node = head;
+        thread_data[i].start_value = i * nodes_per_thread;
+        thread_data[i].num_nodes = nodes_per_thread;
+        pthread_create(&threads[i], NULL, thread_insert_delete_rounds, &thread_data[i]);
+    }
+    for (int i = 0; i < params->num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    my_assert(list_count_nodes(&head) == 1 && head->data == 65535);
+    list_cleanup(&head);
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
+void *thread_own_list(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_nodes; i++)
+        list_add(data->list, i);
+    for (int i = 1; i < data->num_nodes; i += 2)
+        list_remove(data->list, i);
+    return NULL;
+}
+
+/* Tests lists created side by side in one pool, every thread working on its own */
+void test_list_objects(TestParams *params)
+{
+    printf_yellow("  Testing independent lists (%s locking, threads: %d, nodes: %d) ---> ",
+                  params->locking == LIST_LOCK_COUPLING ? "coupled" : "global", params->num_threads, params->num_nodes);
+    mem_init(2 * params->num_threads * (params->num_nodes * sizeof(Node) + 256));
+
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        thread_data[i].list = list_create(params->locking, i % (MEM_TAG_COUNT - 1) + 1);
+        thread_data[i].num_nodes = params->num_nodes;
+        my_assert(thread_data[i].list != NULL);
+        pthread_create(&threads[i], NULL, thread_own_list, &thread_data[i]);
+    }
+    for (int i = 0; i < params->num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    // Each list holds the even values in order, whatever the others did
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        List *list = thread_data[i].list;
+        my_assert(list_size(list) == (size_t)params->num_nodes / 2);
+        Node *walker = list_first(list);
+        for (int k = 0; k < params->num_nodes; k += 2, walker = walker->next)
+            my_assert(walker && walker->data == k);
+        my_assert(walker == NULL);
+    }
+
+    // Destroying one list leaves the others alone
+    list_destroy(thread_data[0].list);
+    for (int i = 1; i < params->num_threads; i++)
+        my_assert(list_find(thread_data[i].list, params->num_nodes - 2) != NULL);
+    for (int i = 1; i < params->num_threads; i++)
+        list_destroy(thread_data[i].list);
+
+    // A list's nodes and the list itself count under its tag until list_destroy
+    List *list = list_create(params->locking, MEM_TAG_COUNT - 1);
+    list_add(list, 1);
+    list_add(list, 3);
+    list_add_before(list, list_find(list, 3), 2);
+    list_add_after(list, list_find(list, 3), 4);
+    mem_tag_usage usage;
+    my_assert(mem_tag_stats(MEM_TAG_COUNT - 1, &usage) == 0 && usage.blocks == 5);
+    my_assert(list_size(list) == 4 && list_first(list)->data == 1 && list_first(list)->next->data == 2);
+    list_destroy(list);
+    my_assert(mem_tag_stats(MEM_TAG_COUNT - 1, &usage) == 0 && usage.blocks == 0);
+    my_assert(list_create(params->locking, MEM_TAG_COUNT) == NULL);
+
+    mem_deinit();
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
+void *thread_compact_add(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    for (int i = 0; i < data->num_nodes; i++)
+        my_assert(clist_add(data->clist, data->start_value + i) == 0);
+    return NULL;
+}
+
+/* Tests the compact list and how much of the pool it takes per element next to a List */
+void test_clist(TestParams *params)
+{
+    printf_yellow("  Testing compact list (threads: %d, nodes: %d) ---> ", params->num_threads, params->num_nodes);
+    int nodes_per_thread = params->num_nodes / params->num_threads;
+    mem_init(2 * params->num_nodes * (sizeof(Node) + 64));
+
+    CompactList *clist = clist_create(1);
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        thread_data[i].clist = clist;
+        thread_data[i].start_value = i * nodes_per_thread;
+        thread_data[i].num_nodes = nodes_per_thread;
+        pthread_create(&threads[i], NULL, thread_compact_add, &thread_data[i]);
+    }
+    for (int i = 0; i < params->num_threads; i++)
+        pthread_join(threads[i], NULL);
+    my_assert(clist_size(clist) == (size_t)params->num_nodes);
+
+    // Every thread's values are there, in the order it added them
+    uint16_t *values = malloc(params->num_nodes * sizeof(uint16_t));
+    my_assert(clist_copy(clist, values, params->num_nodes) == (size_t)params->num_nodes);
+    int *next_value = calloc(params->num_threads, sizeof(int));
+    for (int k = 0; k < params->num_nodes; k++)
+    {
+        int thread = values[k] / nodes_per_thread;
+        my_assert(values[k] == thread * nodes_per_thread + next_value[thread]++);
+    }
+
+    // Removed nodes are reused before the list takes more of the pool
+    mem_tag_usage full, refilled, nodes;
+    mem_tag_stats(1, &full);
+    for (int v = 1; v < params->num_nodes; v += 2)
+        my_assert(clist_remove(clist, v) == 0);
+    my_assert(clist_remove(clist, 1) == -1 && errno == ENOENT);
+    my_assert(clist_contains(clist, 0) && !clist_contains(clist, 1));
+    my_assert(clist_size(clist) == (size_t)params->num_nodes / 2);
+    for (int v = 1; v < params->num_nodes; v += 2)
+        my_assert(clist_add(clist, v) == 0);
+    mem_tag_stats(1, &refilled);
+    my_assert(refilled.live_bytes == full.live_bytes);
+
+    // The same values as Nodes of a List
+    List *list = list_create(LIST_LOCK_GLOBAL, 2);
+    for (int v = 0; v < params->num_nodes; v++)
+        list_add(list, v);
+    mem_tag_stats(2, &nodes);
+    my_assert(full.live_bytes * 4 <= nodes.live_bytes);
+    printf("%.1f vs %.1f bytes per element ---> ", (double)full.live_bytes / params->num_nodes, (double)nodes.live_bytes / params->num_nodes);
+
+    list_destroy(list);
+    clist_destroy(clist);
+    mem_deinit();
+    free(values);
+    free(next_value);
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
+/* Tests the unrolled list against an array doing the same adds and removes, with the search named by ULIST_SEARCH */
+void test_ulist(const char *search, int num_nodes)
+{
+    setenv("ULIST_SEARCH", search, 1);
+    mem_init(num_nodes * 64 + 4096);
+    UnrolledList *list = ulist_create(1);
+    unsetenv("ULIST_SEARCH");
+    printf_yellow("  Testing unrolled list (%s search, nodes: %d) ---> ", ulist_search_kind(list), num_nodes);
+
+    uint16_t *model = malloc(num_nodes * sizeof(uint16_t));
+    uint16_t *values = malloc(num_nodes * sizeof(uint16_t));
+    int count = 0;
+    for (int i = 0; i < 4 * num_nodes; i++)
+    {
+        uint16_t value = rand() % (num_nodes / 2); // Duplicates on purpose
+        if (count < num_nodes && rand() % 3)
+        {
+            my_assert(ulist_add(list, value) == 0);
+            model[count++] = value;
+            continue;
+        }
+        int slot = 0;
+        while (slot < count && model[slot] != value)
+            slot++;
+        my_assert(ulist_contains(list, value) == (slot < count));
+        my_assert(ulist_remove(list, value) == (slot < count ? 0 : -1));
+        if (slot < count)
+            memmove(model + slot, model + slot + 1, (--count - slot) * sizeof(uint16_t));
+    }
+    my_assert(ulist_size(list) == (size_t)count);
+    my_assert(ulist_copy(list, values, num_nodes) == (size_t)count);
+    my_assert(memcmp(values, model, count * sizeof(uint16_t)) == 0);
+
+    ulist_destroy(list);
+    mem_deinit();
+    free(model);
+    free(values);
+    printf_green("[PASS].\n");
+}
+
+/* Times searches for values near the end of a long unrolled list and of a compact list */
+void test_ulist_search_speed(int num_nodes, int searches)
+{
+    mem_init(num_nodes * 64 + 4096);
+    UnrolledList *unrolled = ulist_create(1);
+    CompactList *compact = clist_create(2);
+    printf_yellow("  Testing search speed (%s unrolled vs compact, nodes: %d) ---> ", ulist_search_kind(unrolled), num_nodes);
+    for (int v = 0; v < num_nodes; v++)
+    {
+        ulist_add(unrolled, v);
+        clist_add(compact, v);
+    }
+
+    struct timespec start, middle, end;
+    int found = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < searches; i++)
+        found += ulist_contains(unrolled, num_nodes - 1 - i % 64);
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    for (int i = 0; i < searches; i++)
+        found += clist_contains(compact, num_nodes - 1 - i % 64);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    my_assert(found == 2 * searches);
+    my_assert(!ulist_contains(unrolled, num_nodes) && !clist_contains(compact, num_nodes));
+    printf("%.2f ms vs %.2f ms ---> ", ((middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec)) / 1e6,
+           ((end.tv_sec - middle.tv_sec) * 1e9 + (end.tv_nsec - middle.tv_nsec)) / 1e6);
+
+    ulist_destroy(unrolled);
+    clist_destroy(compact);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/* Tests a list with a value index against one without, doing the same operations on values that repeat */
+void test_list_index(int num_nodes)
+{
+    printf_yellow("  Testing value index (nodes: %d) ---> ", num_nodes);
+    mem_init(8 * num_nodes * sizeof(Node) + (2 << 20));
+    List *indexed = list_create(LIST_LOCK_GLOBAL, 1);
+    List *plain = list_create(LIST_LOCK_GLOBAL, 2);
+    for (int i = 0; i < num_nodes / 4; i++)
+    {
+        list_add(indexed, i % 256);
+        list_add(plain, i % 256);
+    }
+    if (list_index(indexed) != 0) // The lock-free list has no index
+    {
+        my_assert(errno == EINVAL);
+        printf("no index ---> ");
+    }
+    List *coupled = list_create(LIST_LOCK_COUPLING, 3); // Lock coupling has no index either
+    my_assert(list_index(coupled) == -1 && errno == EINVAL);
+    list_destroy(coupled);
+
+    for (int i = 0; i < 4 * num_nodes; i++)
+    {
+        uint16_t value = rand() % 256, anchor = rand() % 256;
+        switch (list_size(plain) < (size_t)num_nodes ? rand() % 4 : 3)
+        {
+        case 0:
+            list_add(indexed, value);
+            list_add(plain, value);
+            break;
+        case 1:
+            list_add_after(indexed, list_find(indexed, anchor), value);
+            list_add_after(plain, list_find(plain, anchor), value);
+            break;
+        case 2:
+            list_add_before(indexed, list_find(indexed, anchor), value);
+            list_add_before(plain, list_find(plain, anchor), value);
+            break;
+        case 3:
+            list_remove(indexed, value);
+            list_remove(plain, value);
+            break;
+        }
+    }
+
+    // Same values in the same order, and every lookup lands on the first node of its value
+    my_assert(list_size(indexed) == list_size(plain));
+    Node *walker = list_first(indexed);
+    for (Node *other = list_first(plain); other; other = other->next, walker = walker->next)
+        my_assert(walker && walker->data == other->data);
+    for (int value = 0; value < 257; value++)
+    {
+        my_assert(list_count_value(indexed, value) == list_count_value(plain, value));
+        Node *first = list_first(indexed);
+        while (first && first->data != value)
+            first = first->next;
+        my_assert(list_find(indexed, value) == first);
+    }
+
+    // Looking up a value that is missing no longer walks the list
+    struct timespec start, middle, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 1000; i++)
+        my_assert(list_find(indexed, 1000 + i) == NULL);
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    for (int i = 0; i < 1000; i++)
+        my_assert(list_find(plain, 1000 + i) == NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%.2f ms vs %.2f ms ---> ", ((middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec)) / 1e6,
+           ((end.tv_sec - middle.tv_sec) * 1e9 + (end.tv_nsec - middle.tv_nsec)) / 1e6);
+
+    list_destroy(indexed);
+    list_destroy(plain);
+    mem_tag_usage usage;
+    my_assert(mem_tag_stats(1, &usage) == 0 && usage.blocks == 0);
+    mem_deinit();
+
+    // The Node** functions go through the same index once list_build_index made it
+    Node *head;
+    list_init(&head, 2 * num_nodes * sizeof(Node) + (2 << 20));
+    for (int i = 0; i < num_nodes; i++)
+        list_insert(&head, i % 256);
+    if (list_build_index(&head) == 0)
+    {
+        list_delete(&head, 7);
+        Node *second = head;
+        while (second->data != 7)
+            second = second->next;
+        my_assert(list_search(&head, 7) == second);
+        my_assert(list_delete_all(&head, 3) == (size_t)num_nodes / 256 && list_search(&head, 3) == NULL);
+        list_insert(&head, 3);
+        my_assert(list_search(&head, 3) && list_search(&head, 3)->next == NULL);
+        my_assert(list_search(&head, 1000) == NULL);
+        my_assert(list_count_nodes(&head) == num_nodes - 1 - num_nodes / 256 + 1);
+    }
+    else
+        my_assert(errno == EINVAL);
+    list_cleanup(&head);
+    printf_green("[PASS].\n");
+}
+
+void *thread_add_bulk(void *arg)
+{
+    thread_data_t *data = (thread_data_t *)arg;
+    uint16_t values[64];
+    for (int done = 0; done < data->num_nodes; done += 64)
+    {
+        for (int i = 0; i < 64; i++)
+            values[i] = data->start_value + done + i;
+        my_assert(list_add_bulk(data->list, values, 64) == 0);
+    }
+    return NULL;
+}
+
+/* Tests the bulk operations on a List, from several threads, and compares them with one call per element */
+void test_list_bulk(TestParams *params)
+{
+    printf_yellow("  Testing bulk operations (%s locking, threads: %d, nodes: %d) ---> ",
+                  params->locking == LIST_LOCK_COUPLING ? "coupled" : "global", params->num_threads, params->num_nodes);
+    int n = params->num_nodes;
+    mem_init_config(4 * n * (sizeof(Node) + 32) + (2 << 20), &(mem_config){.backend = MEM_BACKEND_TLSF}); // O(1) frees, the list work shows
+    List *list = list_create(params->locking, 1);
+    uint16_t *values = malloc(n * sizeof(uint16_t));
+    uint16_t *copy = malloc(n * sizeof(uint16_t));
+
+    // Batches from several threads stay whole and in order
+    pthread_t *threads = malloc(params->num_threads * sizeof(pthread_t));
+    thread_data_t *thread_data = malloc(params->num_threads * sizeof(thread_data_t));
+    for (int i = 0; i < params->num_threads; i++)
+    {
+        thread_data[i].list = list;
+        thread_data[i].start_value = i * (n / params->num_threads);
+        thread_data[i].num_nodes = n / params->num_threads;
+        pthread_create(&threads[i], NULL, thread_add_bulk, &thread_data[i]);
+    }
+    for (int i = 0; i < params->num_threads; i++)
+        pthread_join(threads[i], NULL);
+    my_assert(list_size(list) == (size_t)n && list_copy(list, copy, n) == (size_t)n);
+    for (int k = 0; k < n; k += 64)
+        for (int i = 1; i < 64; i++)
+            my_assert(copy[k + i] == copy[k] + i);
+
+    // Replace, copy back, remove every node holding a value
+    for (int i = 0; i < n; i++)
+        values[i] = i % 8;
+    my_assert(list_assign(list, values, n) == 0);
+    my_assert(list_size(list) == (size_t)n && list_copy(list, copy, n) == (size_t)n);
+    my_assert(memcmp(copy, values, n * sizeof(uint16_t)) == 0);
+    my_assert(list_copy(list, copy, 5) == 5);
+    my_assert(list_remove_all(list, 0) == (size_t)n / 8 && list_remove_all(list, 0) == 0);
+    my_assert(list_remove_all(list, 7) == (size_t)n / 8);
+    my_assert(list_size(list) == (size_t)n / 4 * 3 && list_find(list, 7) == NULL);
+    list_add(list, 7); // The tail is right after removing the last node
+    my_assert(list_copy(list, copy, n) == (size_t)n / 4 * 3 + 1 && copy[0] == 1 && copy[n / 4 * 3] == 7);
+    my_assert(list_assign(list, NULL, 0) == 0 && list_size(list) == 0 && list_first(list) == NULL);
+
+    // The same with an index where there is one
+    if (list_index(list) == 0)
+    {
+        my_assert(list_add_bulk(list, values, n) == 0);
+        my_assert(list_remove_all(list, 3) == (size_t)n / 8 && list_count_value(list, 3) == 0);
+        my_assert(list_find(list, 4) == list_first(list)->next->next->next);
+        my_assert(list_assign(list, values, 16) == 0 && list_count_value(list, 5) == 2);
+    }
+    list_destroy(list);
+
+    // One call per element against one bulk call
+    for (int i = 0; i < n; i++)
+        values[i] = i;
+    struct timespec start, middle, end;
+    list = list_create(params->locking, 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+        list_add(list, values[i]);
+    for (int i = 0; i < n; i++)
+        list_remove(list, values[i]);
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    list_add_bulk(list, values, n);
+    list_assign(list, NULL, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    my_assert(list_size(list) == 0);
+    printf("%.2f ms vs %.2f ms ---> ", ((middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec)) / 1e6,
+           ((end.tv_sec - middle.tv_sec) * 1e9 + (end.tv_nsec - middle.tv_nsec)) / 1e6);
+    list_destroy(list);
+    mem_tag_usage usage;
+    my_assert(mem_tag_stats(1, &usage) == 0 && usage.blocks == 0);
+    mem_deinit();
+
+    // The Node** forms
+    Node *head = NULL;
+    list_init_locking(&head, 2 * n * sizeof(Node), params->locking);
+    my_assert(list_insert_bulk(&head, values, n) == 0 && list_count_nodes(&head) == n);
+    my_assert(list_delete_all(&head, 5) == 1 && list_to_array(&head, copy, n) == (size_t)n - 1 && copy[5] == 6);
+    my_assert(list_from_array(&head, values + 10, 3) == 0 && head->data == 10 && list_count_nodes(&head) == 3);
+    my_assert(list_insert_bulk(&head, values, 4 * n) == -1 && errno == ENOMEM && list_count_nodes(&head) == 3);
+    list_cleanup(&head);
+
+    free(values);
+    free(copy);
+    free(threads);
+    free(thread_data);
+    printf_green("[PASS].\n");
+}
+
+/* Tests edits through a cursor, and compares one cursor pass with one list_add_before per node */
+void test_list_cursor(TestParams *params)
+{
+    printf_yellow("  Testing cursor (%s locking, nodes: %d) ---> ",
+                  params->locking == LIST_LOCK_COUPLING ? "coupled" : "global", params->num_nodes);
+    int n = params->num_nodes;
+    mem_init_config(8 * n * (sizeof(Node) + 32) + (2 << 20), &(mem_config){.backend = MEM_BACKEND_TLSF});
+    List *list = list_create(params->locking, 1);
+    list_index(list); // Cursor edits keep an index current where there is one
+    uint16_t *values = malloc(2 * n * sizeof(uint16_t));
+    uint16_t *copy = malloc(2 * n * sizeof(uint16_t));
+    for (int i = 0; i < n; i++)
+        values[i] = i;
+    my_assert(list_add_bulk(list, values, n) == 0);
+
+    // Drop the odd values, put i + n in front of each even one
+    list_cursor cursor;
+    for (Node *node = list_cursor_begin(list, &cursor, true); node;)
+    {
+        if (node->data % 2)
+        {
+            my_assert(list_cursor_delete_here(&cursor) == 0);
+            node = cursor.node;
+        }
+        else
+        {
+            my_assert(list_cursor_insert_here(&cursor, node->data + n) == 0 && cursor.node == node);
+            node = list_cursor_next(&cursor);
+        }
+    }
+    my_assert(list_cursor_delete_here(&cursor) == -1 && errno == ENOENT);
+    my_assert(list_cursor_insert_here(&cursor, 2 * n) == 0); // Past the end it appends
+    list_cursor_end(&cursor);
+    my_assert(list_size(list) == (size_t)n + 1 && list_copy(list, copy, 2 * n) == (size_t)n + 1);
+    for (int i = 0; i < n; i += 2)
+        my_assert(copy[i] == i + n && copy[i + 1] == i);
+    my_assert(copy[n] == 2 * n && list_find(list, 1) == NULL && list_find(list, n)->next->data == 0);
+
+    // A read cursor sees every node and refuses edits
+    size_t seen = 0;
+    for (Node *node = list_cursor_begin(list, &cursor, false); node; node = list_cursor_next(&cursor))
+        seen++;
+    my_assert(list_cursor_insert_here(&cursor, 0) == -1 && errno == EPERM);
+    my_assert(list_cursor_delete_here(&cursor) == -1 && errno == EPERM);
+    list_cursor_end(&cursor);
+    my_assert(seen == (size_t)n + 1);
+
+    // Deleting the last node leaves the tail right for the next list_add
+    Node *node = list_cursor_begin(list, &cursor, true);
+    while (node->next)
+        node = list_cursor_next(&cursor);
+    my_assert(list_cursor_delete_here(&cursor) == 0 && cursor.node == NULL);
+    list_cursor_end(&cursor);
+    list_add(list, 7);
+    my_assert(list_copy(list, copy, 2 * n) == (size_t)n + 1 && copy[n] == 7 && list_count_value(list, 7) == 1);
+    list_destroy(list);
+
+    // A node in front of every node: one list_add_before each, then one cursor pass
+    struct timespec start, middle, end;
+    list = list_create(params->locking, 1);
+    list_add_bulk(list, values, n);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (Node *next = list_first(list); next; next = next->next)
+        list_add_before(list, next, 0);
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    for (node = list_cursor_begin(list, &cursor, true); node; node = list_cursor_next(&cursor))
+        list_cursor_insert_here(&cursor, 0);
+    list_cursor_end(&cursor);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    my_assert(list_size(list) == 4 * (size_t)n);
+    printf("%.2f ms vs %.2f ms ---> ", ((middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec)) / 1e6,
+           ((end.tv_sec - middle.tv_sec) * 1e9 + (end.tv_nsec - middle.tv_nsec)) / 1e6);
+    list_destroy(list);
+    mem_tag_usage usage;
+    my_assert(mem_tag_stats(1, &usage) == 0 && usage.blocks == 0);
+    mem_deinit();
+
+    free(values);
+    free(copy);
+    printf_green("[PASS].\n");
+}
+
+/* Reads back what list_write put into @p file */
+static size_t read_back(FILE *file, char *out, size_t max)
+{
+    size_t length = lseek(fileno(file), 0, SEEK_END);
+    my_assert(length <= max && pread(fileno(file), out, length, 0) == (ssize_t)length);
+    my_assert(ftruncate(fileno(file), 0) == 0 && lseek(fileno(file), 0, SEEK_SET) == 0);
+    return length;
+}
+
+/* Tests list_write in each format, and compares it with one fprintf per value */
+void test_list_write(TestParams *params)
+{
+    printf_yellow("  Testing list_write (%s locking, nodes: %d) ---> ",
+                  params->locking == LIST_LOCK_COUPLING ? "coupled" : "global", params->num_nodes);
+    int n = params->num_nodes;
+    mem_init_config(2 * n * (sizeof(Node) + 32) + (2 << 20), &(mem_config){.backend = MEM_BACKEND_TLSF});
+    List *list = list_create(params->locking, 1);
+    size_t max = 8 * (size_t)n + 2;
+    char *expected = malloc(max);
+    char *written = malloc(max);
+    FILE *file = tmpfile();
+
+    // An empty list
+    my_assert(list_write(list, fileno(file), LIST_FORMAT_TEXT) == 0);
+    my_assert(read_back(file, written, max) == 2 && memcmp(written, "[]", 2) == 0);
+    my_assert(list_write(list, fileno(file), LIST_FORMAT_BINARY | LIST_FORMAT_SNAPSHOT) == 0 && read_back(file, written, max) == 0);
+
+    // Text matches what printf makes of the values, with and without a snapshot
+    size_t length = 0;
+    expected[length++] = '[';
+    for (int i = 0; i < n; i++)
+    {
+        uint16_t data = (uint16_t)(i * 7919);
+        list_add(list, data);
+        length += sprintf(expected + length, i ? ", %d" : "%d", data);
+    }
+    expected[length++] = ']';
+    my_assert(list_write(list, fileno(file), LIST_FORMAT_TEXT) == 0);
+    my_assert(read_back(file, written, max) == length && memcmp(written, expected, length) == 0);
+    my_assert(list_write(list, fileno(file), LIST_FORMAT_SNAPSHOT) == 0);
+    my_assert(read_back(file, written, max) == length && memcmp(written, expected, length) == 0);
+
+    // Binary is the values in list order, low byte first
+    uint16_t *values = malloc(n * sizeof(uint16_t));
+    my_assert(list_copy(list, values, n) == (size_t)n);
+    for (int snapshot = 0; snapshot < 2; snapshot++)
+    {
+        my_assert(list_write(list, fileno(file), LIST_FORMAT_BINARY | (snapshot ? LIST_FORMAT_SNAPSHOT : 0)) == 0);
+        my_assert(read_back(file, written, max) == 2 * (size_t)n);
+        for (int i = 0; i < n; i++)
+            my_assert((uint8_t)written[2 * i] + ((uint8_t)written[2 * i + 1] << 8) == values[i]);
+    }
+
+    // A failed write is reported and leaves the list usable
+    my_assert(list_write(list, -1, LIST_FORMAT_TEXT) == -1 && errno == EBADF);
+    my_assert(list_write(list, -1, LIST_FORMAT_SNAPSHOT) == -1 && errno == EBADF);
+    list_add(list, 1);
+    my_assert(list_size(list) == (size_t)n + 1);
+
+    // One fprintf per value and separator against one list_write
+    FILE *null = fopen("/dev/null", "w");
+    struct timespec start, middle, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int k = 0; k < 10; k++)
+    {
+        fprintf(null, "[");
+        for (Node *node = list_first(list); node; node = node->next)
+        {
+            fprintf(null, "%d", node->data);
+            if (node->next)
+                fprintf(null, ", ");
+        }
+        fprintf(null, "]");
+        fflush(null);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &middle);
+    for (int k = 0; k < 10; k++)
+        list_write(list, fileno(null), LIST_FORMAT_TEXT);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("%.2f ms vs %.2f ms ---> ", ((middle.tv_sec - start.tv_sec) * 1e9 + (middle.tv_nsec - start.tv_nsec)) / 1e6,
+           ((end.tv_sec - middle.tv_sec) * 1e9 + (end.tv_nsec - middle.tv_nsec)) / 1e6);
+    fclose(null);
+
+    list_destroy(list);
+    mem_tag_usage usage;
+    my_assert(mem_tag_stats(1, &usage) == 0 && usage.blocks == 0);
+    my_assert(mem_tag_stats(0, &usage) == 0 && usage.blocks == 0); // The snapshots went back
+    mem_deinit();
+    fclose(file);
+    free(values);
+    free(expected);
+    free(written);
+    printf_green("[PASS].\n");
+}
+
 // Main function to run all tests
 int main(int argc, char *argv[])
 {
@@ -670,6 +1400,15 @@ int main(int argc, char *argv[])
         printf(" 6. test_list_insert_after - Test multiple insertions after a given node\n");
         printf(" 7. test_list_insert_after - Test multiple insertions after a given node\n");
         printf(" 8. test_list_delete - Test multiple detelions\n");
+        printf(" 9. test_list_lock_coupling - Basic operations with hand-over-hand node locking\n");
+        printf("10. test_list_sequential - Single-threaded loops over 16384 nodes and edge cases\n");
+        printf("11. test_list_objects - Independent lists sharing one pool\n");
+        printf("12. test_clist - Compact list with 8-byte nodes\n");
+        printf("13. test_ulist - Unrolled list with SIMD and scalar search\n");
+        printf("14. test_list_index - Value index for list_find and list_remove\n");
+        printf("15. test_list_bulk - Bulk insert, delete, copy and replace\n");
+        printf("16. test_list_cursor - Inserts and deletes during one traversal\n");
+        printf("17. test_list_write - Buffered text and binary output, with and without a snapshot\n");
         printf(" 0. Run all tests\n");
         return 1;
     }
@@ -729,6 +1468,75 @@ int main(int argc, char *argv[])
             for (int j = 8; j < 14; j++) // from 2^8 = 256 up to 2^14 = 16384 nodes
                 test_list_delete_multithreaded(&(TestParams){.num_threads = pow(2, i), .num_nodes = pow(2, j)});
         break;
+    case 9:
+        printf("Testing Basic Operations with lock coupling:\n");
+        test_list_insert_multithread(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024, .locking = LIST_LOCK_COUPLING});
+        test_list_insert_after_multithread(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024, .locking = LIST_LOCK_COUPLING});
+        test_list_insert_before_multithreaded(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024, .locking = LIST_LOCK_COUPLING});
+        test_list_delete_multithreaded(&(TestParams){.num_threads = base_num_threads, .num_nodes = 1024, .locking = LIST_LOCK_COUPLING});
+        for (int i = 0; i < 5; i++) // 1 to 16 threads, each working after its own node
+        {
+            test_list_insert_after_spread(&(TestParams){.num_threads = pow(2, i), .num_nodes = 4096});
+            test_list_insert_after_spread(&(TestParams){.num_threads = pow(2, i), .num_nodes = 4096, .locking = LIST_LOCK_COUPLING});
+        }
+        test_list_mixed_multithread(&(TestParams){.num_threads = 16, .num_nodes = 2048});
+        test_list_mixed_multithread(&(TestParams){.num_threads = 16, .num_nodes = 2048, .locking = LIST_LOCK_COUPLING});
+        break;
+    case 10:
+        printf("Testing single-threaded operations:\n");
+        test_list_insert_loop(16384);
+        test_list_insert_after_loop(16384);
+        test_list_delete_loop(16384);
+        test_list_search_loop(16384);
+        test_list_edge_cases();
+        test_list_tail();
+        break;
+    case 11:
+        printf("Testing independent lists:\n");
+        for (int i = 0; i < 5; i++) // 1 to 16 threads, each with its own list
+        {
+            test_list_objects(&(TestParams){.num_threads = pow(2, i), .num_nodes = 1024});
+            test_list_objects(&(TestParams){.num_threads = pow(2, i), .num_nodes = 1024, .locking = LIST_LOCK_COUPLING});
+        }
+        break;
+    case 12:
+        printf("Testing compact list:\n");
+        for (int i = 0; i < 5; i++) // 1 to 16 threads adding to one list
+            test_clist(&(TestParams){.num_threads = pow(2, i), .num_nodes = 16384});
+        break;
+    case 13:
+        printf("Testing unrolled list:\n");
+        test_ulist("scalar", 4096);
+        test_ulist("sse2", 4096);
+        test_ulist("avx2", 4096);
+        test_ulist_search_speed(16384, 2000);
+        break;
+    case 14:
+        printf("Testing value index:\n");
+        test_list_index(1024);
+        test_list_index(16384);
+        break;
+    case 15:
+        printf("Testing bulk operations:\n");
+        for (int i = 0; i < 5; i++) // 1 to 16 threads adding batches to one list
+        {
+            test_list_bulk(&(TestParams){.num_threads = pow(2, i), .num_nodes = 8192});
+            test_list_bulk(&(TestParams){.num_threads = pow(2, i), .num_nodes = 8192, .locking = LIST_LOCK_COUPLING});
+        }
+        break;
+    case 16:
+        printf("Testing cursor:\n");
+        test_list_cursor(&(TestParams){.num_nodes = 1024});
+        test_list_cursor(&(TestParams){.num_nodes = 1024, .locking = LIST_LOCK_COUPLING});
+        test_list_cursor(&(TestParams){.num_nodes = 8192});
+        test_list_cursor(&(TestParams){.num_nodes = 8192, .locking = LIST_LOCK_COUPLING});
+        break;
+    case 17:
+        printf("Testing list_write:\n");
+        test_list_write(&(TestParams){.num_nodes = 16});
+        test_list_write(&(TestParams){.num_nodes = 16384});
+        test_list_write(&(TestParams){.num_nodes = 16384, .locking = LIST_LOCK_COUPLING});
+        break;
 
     default:
         printf("Invalid test function\n");
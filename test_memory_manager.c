@@ -12,8 +12,15 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include "common_defs.h"
+#include "fixed_pool.h"
+#include "cm2_trace.h"
 
 #include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <errno.h>
+#include <stdint.h>
 
 #define debug 0
 
@@ -887,6 +894,790 @@ void test_looking_for_out_of_bounds()
     printf("[PASS].\n");
 }
 
+/*
+ * This function tests the file-backed pool: allocations and the root pointer written before mem_deinit
+ * have to be found again after the file is reopened, and a damaged file has to be rejected on open.
+ */
+void test_file_backed_pool()
+{
+    printf_yellow("  Testing \"mem_init_file\" persistence ---> ");
+    char path[] = "/tmp/mm_pool_XXXXXX";
+    int fd = mkstemp(path);
+    my_assert(fd >= 0);
+    close(fd);
+    unlink(path); // mem_init_file creates the pool from scratch
+
+    my_assert(mem_init_file(path, 4096) == 0);
+    size_t *offsets = mem_alloc(4 * sizeof(size_t)); // Blocks are recorded relative to the root
+    for (int i = 0; i < 4; i++)
+    {
+        char *block = mem_alloc(100 + i);
+        memset(block, 'a' + i, 100 + i);
+        offsets[i] = block - (char *)offsets;
+    }
+    mem_free((char *)offsets + offsets[1]);
+    mem_set_root(offsets);
+    mem_deinit();
+
+    // Reopen the pool and check that the root and the blocks around the freed one survived
+    my_assert(mem_init_file(path, 0) == 0);
+    my_assert(mem_check() == 0);
+    char *root = mem_get_root();
+    my_assert(root != NULL);
+    offsets = (size_t *)root;
+    sanityCheck(100, root + offsets[0], 'a');
+    sanityCheck(102, root + offsets[2], 'c');
+    sanityCheck(103, root + offsets[3], 'd');
+    my_assert(mem_alloc(101) == root + offsets[1]); // The freed hole is still free
+    mem_deinit();
+
+    // Without a pool, frees and setting the root do nothing
+    mem_free(root);
+    mem_free_batch((void **)&root, 1);
+    mem_set_root(root);
+    my_assert(mem_get_root() == NULL);
+
+    // A pool of a different size must not be accepted
+    my_assert(mem_init_file(path, 8192) == -1);
+
+    // Damage the header and check that opening fails
+    fd = open(path, O_RDWR);
+    long garbage = 0;
+    pwrite(fd, &garbage, sizeof(garbage), 0);
+    close(fd);
+    my_assert(mem_init_file(path, 0) == -1);
+
+    unlink(path);
+    printf_green("[PASS].\n");
+}
+
+/*
+ * This function tests the shared memory pool: forked worker processes attach to the pool by name, allocate
+ * blocks concurrently and hand them back to the parent as offsets, which the parent then reads without copying.
+ */
+void test_shared_pool(int num_processes)
+{
+    printf_yellow("  Testing \"mem_init_shared\" (processes: %d) ---> ", num_processes);
+    char name[64];
+    snprintf(name, sizeof(name), "/mm_test_%d", (int)getpid());
+    shm_unlink(name);
+
+    my_assert(mem_init_shared(name, 64 * 1024) == 0);
+    size_t *handoff = mem_alloc(num_processes * 16 * sizeof(size_t)); // Offsets written by the workers
+    mem_set_root(handoff);
+
+    for (int p = 0; p < num_processes; p++)
+    {
+        if (fork() == 0)
+        {
+            // Drop the inherited mapping and attach again the way an unrelated process would
+            mem_deinit();
+            if (mem_init_shared(name, 0) != 0)
+                _exit(1);
+            size_t *slots = mem_get_root();
+            for (int i = 0; i < 16; i++)
+            {
+                char *block = mem_alloc(256);
+                if (!block)
+                    _exit(1);
+                memset(block, p * 16 + i, 256);
+                slots[p * 16 + i] = mem_offset(block);
+            }
+            mem_deinit();
+            _exit(0);
+        }
+    }
+
+    int failures = 0;
+    for (int p = 0; p < num_processes; p++)
+    {
+        int status;
+        wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failures++;
+    }
+    my_assert(failures == 0);
+
+    // Every block written by a worker is visible in place and no two blocks overlap
+    for (int i = 0; i < num_processes * 16; i++)
+    {
+        sanityCheck(256, mem_at(handoff[i]), (char)i);
+        mem_free(mem_at(handoff[i]));
+    }
+    my_assert(mem_check() == 0);
+
+    mem_deinit();
+    shm_unlink(name);
+    printf_green("[PASS].\n");
+}
+
+/* Restores a copy of @p snapshot with the 8 bytes at @p offset set to @p value, grown to @p length if nonzero */
+int restore_patched(FILE *snapshot, off_t offset, uint64_t value, off_t length)
+{
+    FILE *copy = tmpfile();
+    char buffer[65536];
+    ssize_t n;
+    for (off_t at = 0; (n = pread(fileno(snapshot), buffer, sizeof(buffer), at)) > 0; at += n)
+        my_assert(write(fileno(copy), buffer, n) == n);
+    my_assert(pwrite(fileno(copy), &value, sizeof(value), offset) == sizeof(value));
+    if (length)
+        my_assert(ftruncate(fileno(copy), length) == 0);
+    int result = mem_restore(fileno(copy));
+    fclose(copy);
+    return result;
+}
+
+/*
+ * This function tests pool snapshots: a full snapshot followed by an incremental one has to bring back
+ * exactly the pool contents at the time each snapshot was taken, and the incremental snapshot must only
+ * contain the few pages that changed in between.
+ */
+void test_snapshot_restore()
+{
+    printf_yellow("  Testing \"mem_snapshot\" and \"mem_restore\" ---> ");
+    size_t pool_size = 1024 * 1024;
+    FILE *full = tmpfile();
+    FILE *incremental = tmpfile();
+
+    mem_init(pool_size);
+    char *blocks[64];
+    for (int i = 0; i < 64; i++)
+    {
+        blocks[i] = mem_alloc(pool_size / 64);
+        memset(blocks[i], i, pool_size / 64);
+    }
+    my_assert(mem_snapshot(fileno(full)) == 0);
+
+    // Change one block and the block list, then save only what changed
+    memset(blocks[3], 'x', pool_size / 64);
+    mem_free(blocks[10]);
+    my_assert(mem_snapshot_incremental(fileno(incremental)) == 0);
+    struct stat full_st, incremental_st;
+    fstat(fileno(full), &full_st);
+    fstat(fileno(incremental), &incremental_st);
+    my_assert(incremental_st.st_size < full_st.st_size / 8);
+
+    // Diverge from both snapshots
+    memset(blocks[3], 'y', pool_size / 64);
+    memset(blocks[20], 'y', pool_size / 64);
+
+    my_assert(mem_restore(fileno(full)) == 0);
+    sanityCheck(pool_size / 64, blocks[3], 3);
+    sanityCheck(pool_size / 64, blocks[20], 20);
+    my_assert(mem_alloc(pool_size / 64) == NULL); // blocks[10] is allocated again
+
+    my_assert(mem_restore(fileno(incremental)) == 0);
+    sanityCheck(pool_size / 64, blocks[3], 'x');
+    sanityCheck(pool_size / 64, blocks[20], 20);
+    my_assert(mem_alloc(pool_size / 64) == blocks[10]); // and free again
+    my_assert(mem_check() == 0);
+
+    // An incremental snapshot does not apply twice
+    my_assert(mem_restore(fileno(incremental)) == -1);
+
+    // Damaged snapshots are turned down before anything is copied. A snapshot
+    // starts with magic, kind, page size, geometry, generation, image size and
+    // run count; the runs follow as offset and length, each with its data.
+    my_assert(restore_patched(full, 32, 64 << 20, (64 << 20) + 64) == -1); // Image larger than the mapping
+    my_assert(restore_patched(full, 32, 4 << 20, (4 << 20) + 64) == -1);   // Image past the committed nodes
+    my_assert(mem_restore(fileno(full)) == 0);
+    uint64_t run_count, first_length;
+    my_assert(pread(fileno(incremental), &run_count, 8, 40) == 8 && run_count >= 2);
+    my_assert(pread(fileno(incremental), &first_length, 8, 56) == 8);
+    my_assert(restore_patched(incremental, 48 + 16 + first_length, UINT64_MAX - 8, 0) == -1); // offset + length wraps
+    my_assert(mem_restore(fileno(incremental)) == 0);
+    sanityCheck(pool_size / 64, blocks[3], 'x');
+
+    // Tracking keeps system calls from writing into blocks until it is stopped
+    struct sigaction before, during, after;
+    mem_snapshot_stop(); // The handler from the snapshots above goes
+    sigaction(SIGSEGV, NULL, &before);
+    my_assert(mem_snapshot(fileno(full)) == 0);
+    sigaction(SIGSEGV, NULL, &during);
+    my_assert(during.sa_handler != before.sa_handler);
+    int pipe_fds[2];
+    my_assert(pipe(pipe_fds) == 0);
+    my_assert(write(pipe_fds[1], "abc", 3) == 3);
+    errno = 0;
+    my_assert(read(pipe_fds[0], blocks[5], 3) == -1 && errno == EFAULT);
+    mem_snapshot_stop();
+    my_assert(read(pipe_fds[0], blocks[5], 3) == 3 && blocks[5][2] == 'c');
+    sigaction(SIGSEGV, NULL, &after);
+    my_assert(after.sa_handler == before.sa_handler);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+
+    mem_deinit();
+    fclose(full);
+    fclose(incremental);
+    printf_green("[PASS].\n");
+}
+
+/* Tests a backend against random allocations, resizes and frees, checking block contents and metadata as it goes */
+void test_backend(mem_backend backend, const char *name)
+{
+    printf_yellow("  Testing the %s backend ---> ", name);
+    size_t pool_size = 1024 * 1024;
+    my_assert(mem_init_config(pool_size, &(mem_config){.backend = backend}) == 0);
+
+    enum { SLOTS = 512 };
+    char *blocks[SLOTS] = {0};
+    size_t sizes[SLOTS] = {0};
+    srand(42);
+    for (int step = 0; step < 20000; step++)
+    {
+        int i = rand() % SLOTS;
+        if (blocks[i])
+        {
+            sanityCheck(sizes[i], blocks[i], (char)i);
+            if (rand() % 2)
+            {
+                size_t size = 1 + rand() % 4096;
+                char *resized = mem_resize(blocks[i], size);
+                if (resized)
+                {
+                    sanityCheck(size < sizes[i] ? size : sizes[i], resized, (char)i);
+                    memset(resized, i, size);
+                    blocks[i] = resized;
+                    sizes[i] = size;
+                }
+            }
+            else
+            {
+                mem_free(blocks[i]);
+                blocks[i] = NULL;
+            }
+        }
+        else
+        {
+            size_t alignment = (size_t)1 << (rand() % 10);
+            sizes[i] = 1 + rand() % 4096;
+            blocks[i] = mem_alloc_aligned(alignment, sizes[i]);
+            my_assert(blocks[i] != NULL);
+            my_assert((uintptr_t)blocks[i] % alignment == 0);
+            memset(blocks[i], i, sizes[i]);
+        }
+        if (step % 1000 == 0)
+            my_assert(mem_check() == 0);
+    }
+    for (int i = 0; i < SLOTS; i++)
+        mem_free(blocks[i]);
+    my_assert(mem_check() == 0);
+
+    // A second free of a block merged into its free predecessor, and pointers into a block, are ignored
+    char *first = mem_alloc(64), *second = mem_alloc(64), *third = mem_alloc(64);
+    memset(third, 0, 64);
+    mem_free(first);
+    mem_free(second);
+    mem_free(second);
+    my_assert(mem_usable_size(second) == 0 && mem_resize(second, 32) == NULL);
+    my_assert(mem_check() == 0);
+    for (int offset = 16; offset < 64; offset += 16)
+    {
+        mem_free(third + offset);
+        my_assert(mem_usable_size(third + offset) == 0 && mem_resize(third + offset, 32) == NULL);
+    }
+    my_assert(mem_usable_size(third) >= 64);
+    mem_free(third);
+    my_assert(mem_check() == 0);
+
+    // Everything merged back into one block spanning the pool
+    void *all = mem_alloc(pool_size - 64);
+    my_assert(all != NULL);
+    my_assert(mem_alloc(128) == NULL);
+    mem_free(all);
+    my_assert(mem_check() == 0);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+// Longest single mem_alloc or mem_free of 64 bytes while @p holes free 48 byte gaps sit in front of the free space, in nanoseconds
+long worst_case_latency(mem_backend backend, int holes)
+{
+    mem_init_config(16 * 1024 * 1024, &(mem_config){.backend = backend});
+    void **blocks = malloc(2 * holes * sizeof(void *));
+    for (int i = 0; i < 2 * holes; i++)
+        blocks[i] = mem_alloc(48);
+    for (int i = 0; i < 2 * holes; i += 2)
+        mem_free(blocks[i]);
+
+    // The shortest of several rounds' worst cases, so preemption does not count
+    long worst = LONG_MAX;
+    for (int round = 0; round < 5; round++)
+    {
+        long round_worst = 0;
+        for (int op = 0; op < 1000; op++)
+        {
+            struct timespec t0, t1, t2;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            void *block = mem_alloc(64);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            mem_free(block);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            long alloc_ns = (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+            long free_ns = (t2.tv_sec - t1.tv_sec) * 1000000000L + (t2.tv_nsec - t1.tv_nsec);
+            if (alloc_ns > round_worst)
+                round_worst = alloc_ns;
+            if (free_ns > round_worst)
+                round_worst = free_ns;
+        }
+        if (round_worst < worst)
+            worst = round_worst;
+    }
+    free(blocks);
+    mem_deinit();
+    return worst;
+}
+
+/* Shows that the worst case of the TLSF backend does not grow with the number of blocks, unlike the first-fit list */
+void test_worst_case_latency()
+{
+    printf_yellow("  Testing worst-case latency with fragmented pools ---> ");
+    long list_small = worst_case_latency(MEM_BACKEND_LIST, 1000);
+    long list_large = worst_case_latency(MEM_BACKEND_LIST, 32000);
+    long tlsf_small = worst_case_latency(MEM_BACKEND_TLSF, 1000);
+    long tlsf_large = worst_case_latency(MEM_BACKEND_TLSF, 32000);
+    printf("\n    list: %ld ns with 1000 holes, %ld ns with 32000\n", list_small, list_large);
+    printf("    tlsf: %ld ns with 1000 holes, %ld ns with 32000 ---> ", tlsf_small, tlsf_large);
+    my_assert(tlsf_large <= 4 * tlsf_small + 2000);
+    my_assert(tlsf_large < list_large);
+    printf_green("[PASS].\n");
+}
+
+typedef struct fixed_pool_item
+{
+    int owner;
+    int sequence;
+} fixed_pool_item;
+
+DEFINE_FIXED_POOL(item_pool, fixed_pool_item, 64)
+
+void *thread_fixed_pool(void *arg)
+{
+    int id = *(int *)arg;
+    fixed_pool_item *items[16];
+    for (int round = 0; round < 20000; round++)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            items[i] = item_pool_alloc();
+            items[i]->owner = id;
+            items[i]->sequence = i;
+        }
+        for (int i = 0; i < 16; i++)
+        {
+            if (items[i]->owner != id || items[i]->sequence != i)
+                return (void *)1; // Another thread was handed the same object
+            item_pool_free(items[i]);
+        }
+    }
+    return NULL;
+}
+
+/* Tests the compile-time fixed-size pool: capacity, reuse of freed objects and concurrent use */
+void test_fixed_pool()
+{
+    printf_yellow("  Testing \"DEFINE_FIXED_POOL\" ---> ");
+    fixed_pool_item *items[64];
+    for (int i = 0; i < 64; i++)
+    {
+        items[i] = item_pool_alloc();
+        my_assert(items[i] != NULL && item_pool_owns(items[i]));
+    }
+    my_assert(item_pool_alloc() == NULL);
+    item_pool_free(items[10]);
+    my_assert(item_pool_alloc() == items[10]);
+    my_assert(!item_pool_owns(&items));
+    for (int i = 0; i < 64; i++)
+        item_pool_free(items[i]);
+
+    // 4 threads holding 16 objects each use up the pool exactly
+    pthread_t threads[4];
+    int ids[4];
+    for (int i = 0; i < 4; i++)
+    {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, thread_fixed_pool, &ids[i]);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        my_assert(result == NULL);
+    }
+    printf_green("[PASS].\n");
+}
+
+/* Tests per-tag accounting: tagged blocks are counted until freed and keep their tag through resize */
+void test_tagging(mem_backend backend, const char *name)
+{
+    printf_yellow("  Testing \"mem_alloc_tagged\" with the %s backend ---> ", name);
+    mem_init_config(1 << 20, &(mem_config){.backend = backend});
+    mem_tag_usage usage;
+    my_assert(mem_alloc_tagged(64, MEM_TAG_COUNT) == NULL);
+    my_assert(mem_tag_stats(MEM_TAG_COUNT, &usage) == -1);
+
+    void *nodes[100], *buffer = mem_alloc_tagged(4000, 2), *plain = mem_alloc(100);
+    for (int i = 0; i < 100; i++)
+        nodes[i] = mem_alloc_tagged(32, 1);
+    my_assert(mem_tag_stats(1, &usage) == 0 && usage.blocks == 100 && usage.live_bytes == 3200);
+    my_assert(mem_tag_stats(2, &usage) == 0 && usage.blocks == 1 && usage.live_bytes == 4000);
+    my_assert(mem_tag_stats(0, &usage) == 0 && usage.blocks == 1 && usage.live_bytes >= 100 && usage.live_bytes < 128);
+
+    // Growing past its neighbors moves the buffer, it stays under tag 2
+    buffer = mem_resize(buffer, 8000);
+    my_assert(buffer != NULL);
+    my_assert(mem_tag_stats(2, &usage) == 0 && usage.blocks == 1 && usage.live_bytes == 8000);
+    for (int i = 0; i < 50; i++)
+        mem_free(nodes[i]);
+    mem_free(nodes[0]); // Freeing twice must not count twice
+    my_assert(mem_tag_stats(1, &usage) == 0 && usage.blocks == 50 && usage.live_bytes == 1600);
+
+    for (int i = 50; i < 100; i++)
+        mem_free(nodes[i]);
+    mem_free(buffer);
+    mem_free(plain);
+    for (unsigned tag = 0; tag < MEM_TAG_COUNT; tag++)
+        my_assert(mem_tag_stats(tag, &usage) == 0 && usage.blocks == 0 && usage.live_bytes == 0);
+    my_assert(mem_check() == 0);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+// Cache shedding blocks when the pool fills up, fed by test_memory_pressure
+typedef struct pressure_cache
+{
+    void *blocks[100];
+    int count;
+    int fired[101]; // Callbacks seen per threshold
+} pressure_cache;
+
+void evict_on_pressure(unsigned percent, void *arg)
+{
+    pressure_cache *cache = arg;
+    cache->fired[percent]++;
+    if (percent < 95)
+        return;
+    // Runs outside the pool lock, so freeing from here must not deadlock
+    while (cache->count > 50)
+        mem_free(cache->blocks[--cache->count]);
+}
+
+/* Tests fill level callbacks: one call per crossing, re-armed by dropping below, free to use the pool */
+void test_memory_pressure()
+{
+    printf_yellow("  Testing \"mem_pressure_register\" ---> ");
+    mem_init(100000);
+    pressure_cache cache = {0};
+    my_assert(mem_pressure_register(0, evict_on_pressure, &cache) == -1);
+    my_assert(mem_pressure_register(80, evict_on_pressure, &cache) == 0);
+    my_assert(mem_pressure_register(95, evict_on_pressure, &cache) == 0);
+
+    while (cache.count < 79)
+        cache.blocks[cache.count++] = mem_alloc(1000);
+    my_assert(cache.fired[80] == 0);
+    cache.blocks[cache.count++] = mem_alloc(1000);
+    my_assert(cache.fired[80] == 1);
+    while (cache.count < 90)
+        cache.blocks[cache.count++] = mem_alloc(1000);
+    my_assert(cache.fired[80] == 1 && cache.fired[95] == 0);
+
+    // Growing a block crosses 95%, the callback evicts down to 50 blocks
+    cache.blocks[cache.count - 1] = mem_resize(cache.blocks[cache.count - 1], 6000);
+    my_assert(cache.fired[95] == 1 && cache.count == 50);
+
+    // Back above 80% after having dropped below it
+    while (cache.count < 80)
+        cache.blocks[cache.count++] = mem_alloc(1000);
+    my_assert(cache.fired[80] == 2 && cache.fired[95] == 1);
+    mem_deinit();
+
+    // A pool that is already full enough reports it on registration
+    mem_init(1000);
+    void *block = mem_alloc(900);
+    pressure_cache late = {0};
+    my_assert(mem_pressure_register(85, evict_on_pressure, &late) == 0 && late.fired[85] == 1);
+    mem_free(block);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+extern pthread_mutex_t *allocation_lock; // Held directly to make the pool look busy
+
+/* Tests allocation that must not block: immediate EBUSY, ETIMEDOUT at the deadline, success once the lock is free */
+void test_non_blocking_alloc()
+{
+    printf_yellow("  Testing \"mem_try_alloc\" and \"mem_alloc_timed\" ---> ");
+    mem_init(4096);
+    void *block = mem_try_alloc(1000);
+    my_assert(block != NULL);
+    errno = 0;
+    my_assert(mem_try_alloc(8000) == NULL && errno == ENOMEM);
+
+    pthread_mutex_lock(allocation_lock);
+    errno = 0;
+    my_assert(mem_try_alloc(100) == NULL && errno == EBUSY);
+    struct timespec start, deadline;
+    clock_gettime(CLOCK_REALTIME, &start);
+    deadline = start;
+    deadline.tv_nsec += 20000000; // 20 ms
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    errno = 0;
+    my_assert(mem_alloc_timed(100, &deadline) == NULL && errno == ETIMEDOUT);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    my_assert((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec) >= 20000000L);
+    pthread_mutex_unlock(allocation_lock);
+
+    deadline.tv_sec = now.tv_sec + 1;
+    void *timed = mem_alloc_timed(100, &deadline);
+    my_assert(timed != NULL && timed != block);
+    mem_free(timed);
+    mem_free(block);
+    my_assert(mem_check() == 0);
+    mem_deinit();
+
+    // Without a pool there is no lock to try
+    errno = 0;
+    my_assert(mem_try_alloc(100) == NULL && errno == EINVAL);
+    errno = 0;
+    my_assert(mem_alloc_timed(100, &deadline) == NULL && errno == EINVAL);
+    printf_green("[PASS].\n");
+}
+
+/* Tests "mem_owns" and "mem_usable_size": pool bounds, sizes of live blocks, 0 for anything else */
+void test_usable_size(mem_backend backend, const char *name)
+{
+    printf_yellow("  Testing \"mem_owns\" and \"mem_usable_size\" with the %s backend ---> ", name);
+    mem_init_config(1 << 16, &(mem_config){.backend = backend});
+    int local;
+    my_assert(!mem_owns(&local) && !mem_owns(NULL));
+    my_assert(mem_usable_size(&local) == 0);
+
+    char *blocks[20];
+    for (int i = 0; i < 20; i++)
+    {
+        blocks[i] = mem_alloc(17 + i * 10);
+        my_assert(mem_owns(blocks[i]) && mem_owns(blocks[i] + 16 + i * 10));
+        size_t usable = mem_usable_size(blocks[i]);
+        my_assert(usable >= (size_t)(17 + i * 10) && usable < (size_t)(17 + i * 10) + 32);
+        memset(blocks[i], i, usable); // All of it belongs to the block
+    }
+    my_assert(mem_usable_size(blocks[3] + 1) == 0); // Not the start of a block
+    mem_free(blocks[5]);
+    my_assert(mem_usable_size(blocks[5]) == 0);
+    for (int i = 0; i < 20; i++)
+        if (i != 5)
+        {
+            my_assert(blocks[i][mem_usable_size(blocks[i]) - 1] == i);
+            mem_free(blocks[i]);
+        }
+    my_assert(mem_check() == 0);
+
+    // Enough blocks to grow the metadata, some of them freed and resized
+    char *many[2000];
+    for (int i = 0; i < 2000; i++)
+        many[i] = mem_alloc(1 + i % 7);
+    for (int i = 0; i < 2000; i += 3)
+        mem_free(many[i]);
+    for (int i = 0; i < 2000; i++)
+        my_assert(i % 3 == 0 ? mem_usable_size(many[i]) == 0 : mem_usable_size(many[i]) >= (size_t)(1 + i % 7));
+    for (int i = 1; i < 2000; i += 3)
+        many[i] = mem_resize(many[i], 9); // May move into a freed hole
+    my_assert(mem_resize(many[2], 1 << 17) == NULL); // Does not fit, the block stays
+    for (int i = 1; i < 2000; i++)
+        if (i % 3)
+            my_assert(mem_usable_size(many[i]) >= (size_t)(i % 3 == 1 ? 9 : 1 + i % 7));
+    my_assert(mem_check() == 0);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+/* Tests mem_alloc_batch and mem_free_batch, including a batch that does not fit */
+void test_batch_alloc(mem_backend backend, const char *name)
+{
+    printf_yellow("  Testing \"mem_alloc_batch\" and \"mem_free_batch\" with the %s backend ---> ", name);
+    mem_init_config(1 << 16, &(mem_config){.backend = backend});
+    void *blocks[256];
+    my_assert(mem_alloc_batch(48, 256, blocks, 3) == 0);
+    for (int i = 0; i < 256; i++)
+    {
+        my_assert(mem_usable_size(blocks[i]) >= 48);
+        memset(blocks[i], i, 48);
+    }
+    for (int i = 0; i < 256; i++)
+        my_assert(((unsigned char *)blocks[i])[47] == i); // No two blocks overlap
+    mem_tag_usage usage;
+    my_assert(mem_tag_stats(3, &usage) == 0 && usage.blocks == 256);
+
+    // Every block is a block of its own
+    mem_free(blocks[0]);
+    blocks[0] = NULL;
+    mem_free_batch(blocks, 128);
+    my_assert(mem_tag_stats(3, &usage) == 0 && usage.blocks == 128);
+
+    // First fit places a batch where single allocations would go: the freed front, in address order
+    void *refill[64];
+    my_assert(mem_alloc_batch(48, 64, refill, 3) == 0);
+    if (backend != MEM_BACKEND_TLSF)
+        for (int i = 0; i < 64; i++)
+            my_assert((char *)refill[i] < (char *)blocks[128] && (i == 0 || (char *)refill[i] >= (char *)refill[i - 1] + 48));
+    mem_free_batch(refill, 64);
+
+    // All or nothing
+    void *more[2048];
+    errno = 0;
+    my_assert(mem_alloc_batch(48, 2048, more, 3) == -1 && errno == ENOMEM);
+    my_assert(mem_tag_stats(3, &usage) == 0 && usage.blocks == 128);
+    my_assert(mem_alloc_batch(0, 1, more, 3) == -1 && errno == EINVAL);
+    my_assert(mem_alloc_batch(48, 1, more, MEM_TAG_COUNT) == -1 && errno == EINVAL);
+
+    mem_free_batch(blocks + 128, 128);
+    my_assert(mem_tag_stats(3, &usage) == 0 && usage.blocks == 0);
+    my_assert(mem_check() == 0);
+    mem_deinit();
+    printf_green("[PASS].\n");
+}
+
+// Number of the whole pages inside [@p start, @p start + @p size) resident in memory
+size_t resident_pages(char *start, size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)start + page - 1) & ~(uintptr_t)(page - 1);
+    size_t pages = ((uintptr_t)start + size - first) / page, resident = 0;
+    unsigned char *vec = malloc(pages);
+    if (mincore((void *)first, pages * page, vec) != 0)
+        pages = 0;
+    for (size_t i = 0; i < pages; i++)
+        resident += vec[i] & 1;
+    free(vec);
+    return resident;
+}
+
+// Waits up to 2 seconds for the maintenance thread to release all but a few pages of the block at @p start
+bool wait_for_trim(char *start, size_t size)
+{
+    for (int i = 0; i < 200; i++)
+    {
+        if (resident_pages(start, size) < 32)
+            return true;
+        usleep(10000);
+    }
+    return false;
+}
+
+/* Tests the maintenance thread: freed pages are released, pausing holds it off and mem_deinit stops it */
+void test_maintenance_thread(mem_backend backend, const char *name)
+{
+    printf_yellow("  Testing the maintenance thread with the %s backend ---> ", name);
+    const size_t block_size = 4 << 20;
+    my_assert(mem_init_config(block_size * 2, &(mem_config){.backend = backend, .maintenance_interval_ms = 5}) == 0);
+
+    char *block = mem_alloc(block_size);
+    my_assert(block != NULL);
+    memset(block, 0xAB, block_size);
+    mem_free(block);
+    my_assert(wait_for_trim(block, block_size));
+
+    // Nothing is released while paused, everything soon after resuming
+    mem_maintenance_pause();
+    block = mem_alloc(block_size);
+    memset(block, 0xCD, block_size);
+    mem_free(block);
+    usleep(50000);
+    my_assert(resident_pages(block, block_size) > block_size / (size_t)sysconf(_SC_PAGESIZE) / 2);
+    mem_maintenance_resume();
+    my_assert(wait_for_trim(block, block_size));
+
+    // The pool stays usable after its pages were released
+    char *reused = mem_alloc(1 << 20);
+    my_assert(reused != NULL);
+    my_assert(mem_check() == 0);
+    mem_deinit(); // Stops the running thread
+    printf_green("[PASS].\n");
+}
+
+// Average nanoseconds of freeing a random block and allocating it again while @p live blocks are allocated
+double metadata_benchmark(mem_backend backend, int live)
+{
+    mem_init_config((size_t)live * 64, &(mem_config){.backend = backend});
+    void **blocks = malloc(live * sizeof(void *));
+    for (int i = 0; i < live; i++)
+        blocks[i] = mem_alloc(64);
+
+    enum { OPS = 2000 };
+    srand(7);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int op = 0; op < OPS; op++)
+    {
+        int i = rand() % live;
+        mem_free(blocks[i]);
+        blocks[i] = mem_alloc(64); // First fit finds the hole that was just made
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    my_assert(mem_check() == 0);
+    free(blocks);
+    mem_deinit();
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / OPS;
+}
+
+/* Compares the block list with the sorted array metadata as the number of live blocks grows */
+void benchmark_metadata_backends()
+{
+    int live_blocks[] = {1000, 10000, 100000};
+    printf("  live blocks   list (ns/op)   sorted array (ns/op)   speedup\n");
+    for (int i = 0; i < 3; i++)
+    {
+        double list = metadata_benchmark(MEM_BACKEND_LIST, live_blocks[i]);
+        double sorted = metadata_benchmark(MEM_BACKEND_SORTED, live_blocks[i]);
+        printf("  %11d   %12.0f   %20.0f   %6.1fx\n", live_blocks[i], list, sorted, list / sorted);
+    }
+}
+
+/*
+ * Replays a two-thread trace whose free of an address was stamped after another thread's malloc of the same
+ * address. mm_replay has to report the inconsistency and free the older block instead of leaking it.
+ */
+void test_replay_interleaved()
+{
+    printf_yellow("  Testing \"mm_replay\" on an interleaved two-thread trace ---> ");
+    char path[] = "/tmp/mm_trace_XXXXXX";
+    int fd = mkstemp(path);
+    my_assert(fd >= 0);
+    cm2_trace_header header = {CM2_TRACE_MAGIC, CM2_TRACE_VERSION, sizeof(cm2_record), 1};
+    cm2_record records[] = {
+        // Thread 2's ring is flushed first
+        {.timestamp = 2, .size = 64, .result = 0x2000, .tid = 2, .op = CM2_OP_MALLOC},
+        {.timestamp = 3, .size = 200, .result = 0x1000, .tid = 2, .op = CM2_OP_MALLOC}, // Before thread 1's free
+        {.timestamp = 5, .ptr = 0x2000, .tid = 2, .op = CM2_OP_FREE},
+        {.timestamp = 1, .size = 100, .result = 0x1000, .tid = 1, .op = CM2_OP_MALLOC},
+        {.timestamp = 4, .ptr = 0x1000, .tid = 1, .op = CM2_OP_FREE},
+    };
+    my_assert(write(fd, &header, sizeof(header)) == sizeof(header));
+    my_assert(write(fd, records, sizeof(records)) == sizeof(records));
+    close(fd);
+
+    char command[64], line[256];
+    snprintf(command, sizeof(command), "./mm_replay %s", path);
+    FILE *output = popen(command, "r");
+    my_assert(output != NULL);
+    bool peak = false, reported = false;
+    while (fgets(line, sizeof(line), output))
+    {
+        peak |= strstr(line, "peak live bytes:     264 (trace: 264)") != NULL; // 364 if the older block leaked
+        reported |= strstr(line, "inconsistencies:     1 ") != NULL;
+    }
+    my_assert(pclose(output) == 0);
+    my_assert(peak && reported);
+    unlink(path);
+    printf_green("[PASS].\n");
+}
+
 int main(int argc, char *argv[])
 {
 #ifdef VERSION
@@ -902,7 +1693,10 @@ int main(int argc, char *argv[])
         printf("  0. tests various functions with a base number of threads\n");
         printf("  1. tests various functions across variious configurations (number of threads, memory sizes,  iterations)\n");
         printf("  2. stress tests various functions with various configurations. This may take some time (especially if simulate_work flag is set to true.\n");
-        printf("  3. test_looking_for_out_of_bounds, needs LD_PRELOAD=./libmymalloc.so .\n\n");
+        printf("  3. test_looking_for_out_of_bounds, needs LD_PRELOAD=./libmymalloc.so .\n");
+        printf("  4. tests the extended API (file-backed and shared pools, snapshots, ...).\n");
+        printf("  5. benchmarks the block metadata backends.\n");
+        printf("  6. tests mm_replay on synthetic traces, needs ./mm_replay.\n\n");
         return 1;
     }
 
@@ -985,6 +1779,41 @@ int main(int argc, char *argv[])
         test_looking_for_out_of_bounds();
         break;
 
+    case 4:
+        printf("\n*** Testing the extended API: ***\n");
+        test_file_backed_pool();
+        test_shared_pool(base_num_threads);
+        test_snapshot_restore();
+        test_backend(MEM_BACKEND_TLSF, "TLSF");
+        test_backend(MEM_BACKEND_SORTED, "sorted array");
+        test_worst_case_latency();
+        test_fixed_pool();
+        test_maintenance_thread(MEM_BACKEND_LIST, "block list");
+        test_maintenance_thread(MEM_BACKEND_TLSF, "TLSF");
+        test_maintenance_thread(MEM_BACKEND_SORTED, "sorted array");
+        test_tagging(MEM_BACKEND_LIST, "block list");
+        test_tagging(MEM_BACKEND_TLSF, "TLSF");
+        test_tagging(MEM_BACKEND_SORTED, "sorted array");
+        test_memory_pressure();
+        test_non_blocking_alloc();
+        test_usable_size(MEM_BACKEND_LIST, "block list");
+        test_usable_size(MEM_BACKEND_TLSF, "TLSF");
+        test_usable_size(MEM_BACKEND_SORTED, "sorted array");
+        test_batch_alloc(MEM_BACKEND_LIST, "block list");
+        test_batch_alloc(MEM_BACKEND_TLSF, "TLSF");
+        test_batch_alloc(MEM_BACKEND_SORTED, "sorted array");
+        break;
+
+    case 5:
+        printf("\n*** Benchmarking block metadata: ***\n");
+        benchmark_metadata_backends();
+        break;
+
+    case 6:
+        printf("\n*** Testing the trace replay tool: ***\n");
+        test_replay_interleaved();
+        break;
+
     default:
         printf("Invalid test function\n");
         break;
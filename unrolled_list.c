@@ -0,0 +1,261 @@
+// unrolled_list.c
+// Unrolled list: up to 32 values per node, searched a node at a time with
+// SSE2 or AVX2 compares, or value by value where neither is available
+#include "linked_list.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define ULIST_NODE_VALUES 32 // Values per node, a node's values fill one 64-byte cache line
+
+// Values keep list order: the first `count` slots of each node hold them and
+// an add goes into the last node while it has room. A remove shifts the rest
+// of its node down, and a node left half empty takes in its successor when
+// both fit, so nodes stay dense. A search compares all 32 slots of a node in
+// a few instructions and masks off the ones past count.
+
+typedef struct unode {
+    uint16_t values[ULIST_NODE_VALUES];
+    struct unode *next;
+    uint32_t count; // Slots in use
+} unode;
+
+// Bit i is set when values[i] == data, for every slot of the node
+typedef uint32_t (*match_fn)(const uint16_t *values, uint16_t data);
+
+struct UnrolledList {
+    unode *head;
+    unode *tail;
+    size_t count;
+    match_fn match; // Chosen by ulist_create
+    unsigned tag;   // Memory tag the list and its nodes are allocated under
+    pthread_rwlock_t lock;
+};
+
+static uint32_t match_scalar(const uint16_t *values, uint16_t data) {
+    uint32_t mask = 0;
+    for (int i = 0; i < ULIST_NODE_VALUES; i++) mask |= (uint32_t)(values[i] == data) << i;
+    return mask;
+}
+
+#ifdef __SSE2__
+static uint32_t match_sse2(const uint16_t *values, uint16_t data) {
+    __m128i key = _mm_set1_epi16((short)data);
+    uint32_t mask = 0;
+    for (int i = 0; i < ULIST_NODE_VALUES; i += 16) {
+        __m128i low = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(values + i)), key);
+        __m128i high = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(values + i + 8)), key);
+        // Saturating the 16-bit results to 8 bits leaves one mask bit per value
+        mask |= (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(low, high)) << i;
+    }
+    return mask;
+}
+
+__attribute__((target("avx2"))) static uint32_t match_avx2(const uint16_t *values, uint16_t data) {
+    __m256i key = _mm256_set1_epi16((short)data);
+    __m256i low = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)values), key);
+    __m256i high = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(values + 16)), key);
+    // The pack works per 128-bit lane, the permute puts the quarters back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xD8);
+    return (uint32_t)_mm256_movemask_epi8(packed);
+}
+#endif
+
+/// @brief Picks the widest compare the CPU has, unless ULIST_SEARCH names one:
+/// "scalar", "sse2" or "avx2". "avx2" on a CPU without AVX2 falls back to
+/// SSE2; an unknown name, or any name in a build without SSE2, gets scalar
+static match_fn choose_match() {
+    const char *env = getenv("ULIST_SEARCH");
+    if (env && strcmp(env, "scalar") == 0) return match_scalar;
+#ifdef __SSE2__
+    if (!env || strcmp(env, "avx2") == 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return match_avx2;
+    }
+    if (!env || strcmp(env, "sse2") == 0 || strcmp(env, "avx2") == 0) return match_sse2;
+#endif
+    return match_scalar;
+}
+
+/// @brief Name of the compare @p list searches with
+/// @param list list
+/// @return "avx2", "sse2" or "scalar"
+const char *ulist_search_kind(UnrolledList *list) {
+#ifdef __SSE2__
+    if (list->match == match_avx2) return "avx2";
+    if (list->match == match_sse2) return "sse2";
+#endif
+    return "scalar";
+}
+
+// Slots of a node in use
+static uint32_t used_mask(const unode *node) {
+    return node->count == ULIST_NODE_VALUES ? UINT32_MAX : (1u << node->count) - 1;
+}
+
+/// @brief Finds the first slot holding @p data, read or write lock held
+/// @param list list
+/// @param data value to search for
+/// @param prev set to the node before the one found, NULL for the first
+/// @param slot set to the slot of the value in the node found
+/// @return node holding the value, NULL if there is none
+static unode *find(UnrolledList *list, uint16_t data, unode **prev, int *slot) {
+    unode *before = NULL;
+    for (unode *node = list->head; node; before = node, node = node->next) {
+        uint32_t mask = list->match(node->values, data) & used_mask(node);
+        if (mask) {
+            if (prev) *prev = before;
+            if (slot) *slot = __builtin_ctz(mask);
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/// @brief Creates an empty unrolled list in the pool, which mem_init or one of
+/// its variants must have set up
+/// @param tag memory tag for the list and its nodes
+/// @return the list, NULL with errno set if the pool is full or @p tag is out of range
+UnrolledList *ulist_create(unsigned tag) {
+    if (tag >= MEM_TAG_COUNT) {
+        errno = EINVAL;
+        return NULL;
+    }
+    UnrolledList *list = mem_alloc_tagged(sizeof(UnrolledList), tag);
+    if (!list) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *list = (UnrolledList){.match = choose_match(), .tag = tag};
+    int init_result = pthread_rwlock_init(&list->lock, NULL);
+    if (init_result != 0) {
+        mem_free(list);
+        errno = init_result;
+        return NULL;
+    }
+    return list;
+}
+
+/// @brief Frees the nodes and the list; no other thread may use it anymore
+/// @param list list from ulist_create
+void ulist_destroy(UnrolledList *list) {
+    for (unode *node = list->head; node;) {
+        unode *next = node->next;
+        mem_free(node);
+        node = next;
+    }
+    pthread_rwlock_destroy(&list->lock);
+    mem_free(list);
+}
+
+/// @brief Appends a value
+/// @param list list
+/// @param data value to append
+/// @return 0 on success, -1 with errno set to ENOMEM if the pool is full
+int ulist_add(UnrolledList *list, uint16_t data) {
+    pthread_rwlock_wrlock(&list->lock);
+    unode *tail = list->tail;
+    if (!tail || tail->count == ULIST_NODE_VALUES) {
+        tail = mem_alloc_tagged(sizeof(unode), list->tag);
+        if (!tail) {
+            pthread_rwlock_unlock(&list->lock);
+            errno = ENOMEM;
+            return -1;
+        }
+        memset(tail, 0, sizeof(unode));
+        if (list->tail) list->tail->next = tail;
+        else list->head = tail;
+        list->tail = tail;
+    }
+    tail->values[tail->count++] = data;
+    list->count++;
+    pthread_rwlock_unlock(&list->lock);
+    return 0;
+}
+
+/// @brief Removes the first occurrence of @p data
+/// @param list list
+/// @param data value to remove
+/// @return 0 on success, -1 with errno set to ENOENT if the list does not hold it
+int ulist_remove(UnrolledList *list, uint16_t data) {
+    pthread_rwlock_wrlock(&list->lock);
+    unode *prev;
+    int slot;
+    unode *node = find(list, data, &prev, &slot);
+    if (!node) {
+        pthread_rwlock_unlock(&list->lock);
+        errno = ENOENT;
+        return -1;
+    }
+    memmove(node->values + slot, node->values + slot + 1, (node->count - slot - 1) * sizeof(uint16_t));
+    node->count--;
+    list->count--;
+
+    unode *next = node->next;
+    if (node->count == 0) {
+        if (prev) prev->next = next;
+        else list->head = next;
+        if (list->tail == node) list->tail = prev;
+        mem_free(node);
+    } else if (next && node->count < ULIST_NODE_VALUES / 2 && node->count + next->count <= ULIST_NODE_VALUES) {
+        memcpy(node->values + node->count, next->values, next->count * sizeof(uint16_t));
+        node->count += next->count;
+        node->next = next->next;
+        if (list->tail == next) list->tail = node;
+        mem_free(next);
+    }
+    pthread_rwlock_unlock(&list->lock);
+    return 0;
+}
+
+/// @brief Tells whether the list holds @p data
+/// @param list list
+/// @param data value to search for
+/// @return true if found
+bool ulist_contains(UnrolledList *list, uint16_t data) {
+    pthread_rwlock_rdlock(&list->lock);
+    bool found = find(list, data, NULL, NULL) != NULL;
+    pthread_rwlock_unlock(&list->lock);
+    return found;
+}
+
+/// @brief returns the number of values
+/// @param list list
+/// @return size_t
+size_t ulist_size(UnrolledList *list) {
+    pthread_rwlock_rdlock(&list->lock);
+    size_t count = list->count;
+    pthread_rwlock_unlock(&list->lock);
+    return count;
+}
+
+/// @brief Copies the values in list order
+/// @param list list
+/// @param values array receiving up to @p max values
+/// @param max capacity of @p values
+/// @return number of values copied
+size_t ulist_copy(UnrolledList *list, uint16_t *values, size_t max) {
+    pthread_rwlock_rdlock(&list->lock);
+    size_t copied = 0;
+    for (unode *node = list->head; node && copied < max; node = node->next) {
+        size_t take = node->count < max - copied ? node->count : max - copied;
+        memcpy(values + copied, node->values, take * sizeof(uint16_t));
+        copied += take;
+    }
+    pthread_rwlock_unlock(&list->lock);
+    return copied;
+}
+
+/// @brief displays all values
+/// @param list list
+void ulist_print(UnrolledList *list) {
+    pthread_rwlock_rdlock(&list->lock);
+    printf("[");
+    for (unode *node = list->head; node; node = node->next)
+        for (uint32_t i = 0; i < node->count; i++) printf(node == list->head && i == 0 ? "%d" : ", %d", node->values[i]);
+    printf("]");
+    pthread_rwlock_unlock(&list->lock);
+}